@@ -0,0 +1,135 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Compares the direct-indexed keysym to UCS lookups, in both directions, with
+// the binary searches they replaced, over the keysyms of Latin, Cyrillic and
+// Greek layouts.
+//
+//   keysymconvert_benchmark [rounds]
+
+#include "keysymconvert.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static std::vector<KeySym> workload()
+{
+    std::vector<KeySym> keysyms;
+
+    for (KeySym keysym = 0x0020; keysym <= 0x007e; keysym++) keysyms.push_back(keysym);
+    for (KeySym keysym = 0x06a1; keysym <= 0x06ff; keysym++) keysyms.push_back(keysym);
+    for (KeySym keysym = 0x07a1; keysym <= 0x07f9; keysym++) keysyms.push_back(keysym);
+    //a few that have no character at all
+    for (KeySym keysym = 0xff08; keysym <= 0xff1b; keysym++) keysyms.push_back(keysym);
+
+    return keysyms;
+}
+
+template<typename Function>
+static double measure(int rounds, size_t count, Function function)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        function();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / ((double) rounds * count);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 20000;
+    if (rounds < 1) rounds = 1;
+
+    KeySymConvert kconvert;
+    std::vector<KeySym> keysyms = workload();
+    std::vector<char32_t> ucs(keysyms.size());
+
+    //both lookups must agree before timing them
+    for (size_t i = 0; i < keysyms.size(); i++) {
+        if (kconvert.convert(keysyms[i]) != kconvert.convertBySearch(keysyms[i])) {
+            fprintf(stderr, "mismatch for keysym 0x%lx\n", keysyms[i]);
+            return 1;
+        }
+    }
+    for (KeySym keysym = 0; keysym <= 0xffff; keysym++) {
+        if (kconvert.convert(keysym) != kconvert.convertBySearch(keysym)) {
+            fprintf(stderr, "mismatch for keysym 0x%lx\n", keysym);
+            return 1;
+        }
+    }
+
+    for (long character = 0; character <= 0x10ffff; character++) {
+        if (kconvert.keySym(character) != kconvert.keySymBySearch(character)) {
+            fprintf(stderr, "mismatch for character 0x%lx\n", character);
+            return 1;
+        }
+    }
+
+    //the characters of the same layouts
+    std::vector<long> characters;
+    for (size_t i = 0; i < keysyms.size(); i++) {
+        if (kconvert.convert(keysyms[i])) characters.push_back(kconvert.convert(keysyms[i]));
+    }
+
+    volatile long sink = 0;
+
+    double search = measure(rounds, keysyms.size(), [&]() {
+        long sum = 0;
+        for (KeySym keysym : keysyms) sum += kconvert.convertBySearch(keysym);
+        sink = sink + sum;
+    });
+
+    double direct = measure(rounds, keysyms.size(), [&]() {
+        long sum = 0;
+        for (KeySym keysym : keysyms) sum += kconvert.convert(keysym);
+        sink = sink + sum;
+    });
+
+    double batch = measure(rounds, keysyms.size(), [&]() {
+        kconvert.convert(keysyms.data(), ucs.data(), (int) keysyms.size());
+        sink = sink + ucs[rounds % ucs.size()];
+    });
+
+    double reverseSearch = measure(rounds, characters.size(), [&]() {
+        long sum = 0;
+        for (long character : characters) sum += kconvert.keySymBySearch(character);
+        sink = sink + sum;
+    });
+
+    double reverseDirect = measure(rounds, characters.size(), [&]() {
+        long sum = 0;
+        for (long character : characters) sum += kconvert.keySym(character);
+        sink = sink + sum;
+    });
+
+    printf("%zu keysyms x %d rounds\n", keysyms.size(), rounds);
+    printf("binary search  %6.2f ns/keysym\n", search);
+    printf("direct index   %6.2f ns/keysym\n", direct);
+    printf("batch          %6.2f ns/keysym\n", batch);
+    printf("%zu characters x %d rounds\n", characters.size(), rounds);
+    printf("binary search  %6.2f ns/character\n", reverseSearch);
+    printf("direct index   %6.2f ns/character\n", reverseDirect);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# Drives the native Wayland backend against a headless sway session:
+# kvkbd has to connect to the compositor's virtual keyboard manager, inject
+# the keys sent over D-Bus and record one latency sample per key.
+# When wev is installed the keys are also checked on the client side.
+#
+# usage: wayland-headless-check.sh <path to kvkbd>
+# exits 77 when sway or gdbus are not available
+#
+
+set -eu
+
+KVKBD=${1:?usage: $0 <path to kvkbd>}
+
+for tool in sway gdbus dbus-run-session; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "$tool not found, skipping"
+        exit 77
+    fi
+done
+
+#private session bus, so a running kvkbd does not answer
+if [ -z "${KVKBD_CHECK_BUS:-}" ]; then
+    KVKBD_CHECK_BUS=1 exec dbus-run-session -- sh "$0" "$@"
+fi
+
+WORK=$(mktemp -d)
+export XDG_RUNTIME_DIR="$WORK"
+chmod 700 "$WORK"
+
+PIDS=""
+cleanup() {
+    for pid in $PIDS; do
+        kill "$pid" 2>/dev/null || true
+    done
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*"
+    echo "--- kvkbd log"
+    cat "$WORK/kvkbd.log" 2>/dev/null || true
+    exit 1
+}
+
+kvkbd_call() {
+    method=$1
+    shift
+    gdbus call --session --dest org.kde.kvkbd --object-path /Kvkbd --method "org.kde.kvkbd.Kvkbd.$method" "$@"
+}
+
+#sample count of a latency stage, the first value of latencyPercentiles
+sample_count() {
+    kvkbd_call latencyPercentiles "$1" | sed -n 's/^(\[\([0-9]*\).*/\1/p'
+}
+
+: > "$WORK/sway.conf"
+WLR_BACKENDS=headless WLR_LIBINPUT_NO_DEVICES=1 WLR_RENDERER=pixman \
+    sway -c "$WORK/sway.conf" > "$WORK/sway.log" 2>&1 &
+PIDS="$PIDS $!"
+
+SOCKET=""
+for i in $(seq 50); do
+    for s in "$WORK"/wayland-*; do
+        case "$s" in
+            *.lock|*"*") ;;
+            *) SOCKET=$(basename "$s") ;;
+        esac
+    done
+    [ -n "$SOCKET" ] && break
+    sleep 0.1
+done
+[ -n "$SOCKET" ] || { cat "$WORK/sway.log"; fail "sway did not start"; }
+export WAYLAND_DISPLAY="$SOCKET"
+
+#the only window, so it holds the keyboard focus
+HAVE_WEV=""
+if command -v wev >/dev/null 2>&1; then
+    wev -f wl_keyboard:key > "$WORK/wev.log" 2>&1 &
+    PIDS="$PIDS $!"
+    HAVE_WEV=1
+    sleep 0.5
+fi
+
+#kvkbd's own windows stay off the compositor and cannot take the focus
+QT_QPA_PLATFORM=offscreen "$KVKBD" --backend wayland > "$WORK/kvkbd.log" 2>&1 &
+PIDS="$PIDS $!"
+
+for i in $(seq 100); do
+    kvkbd_call latencyStages > /dev/null 2>&1 && break
+    sleep 0.1
+done
+kvkbd_call latencyStages > /dev/null 2>&1 || fail "kvkbd did not register on the session bus"
+
+if grep -q -e "is not available, using x11" -e "does not offer" -e "Unable to" "$WORK/kvkbd.log"; then
+    fail "the Wayland backend did not start"
+fi
+
+kvkbd_call resetLatencyStats > /dev/null
+
+#a, b and c without modifiers
+kvkbd_call pressKeys "[(uint32 38, uint32 0), (uint32 56, uint32 0), (uint32 54, uint32 0)]" > /dev/null
+sleep 0.5
+
+for stage in inject tapToInject; do
+    count=$(sample_count $stage)
+    [ "$count" = "3" ] || fail "$stage has $count samples, expected 3"
+done
+
+if [ -n "$HAVE_WEV" ]; then
+    pressed=$(grep -c "(pressed)" "$WORK/wev.log" || true)
+    [ "$pressed" -ge 3 ] || fail "wev saw $pressed key presses, expected 3"
+fi
+
+kvkbd_call latencyReport
+echo "PASS"
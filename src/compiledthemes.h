@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef COMPILEDTHEMES_H
+#define COMPILEDTHEMES_H
+
+#include <QByteArray>
+#include <QString>
+
+// Layouts of the themes shipped in src/themes, serialized by kvkbd_themec at
+// build time. Returns an empty array for a theme that is not built in.
+QByteArray compiledTheme(const QString& themeName);
+
+#endif // COMPILEDTHEMES_H
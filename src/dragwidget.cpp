@@ -1,4 +1,5 @@
 #include "dragwidget.h"
+#include "x11display.h"
 
 #include <QPainter>
 #include <QStyleOption>
@@ -21,7 +22,12 @@ void DragWidget::blurBackground(bool blurEnabled)
 {
     this->setProperty("blurBackground", QVariant(blurEnabled));
 
-    Display *dpy = XOpenDisplay(nullptr);
+    Display *dpy = X11Display::display();
+    if (!dpy) {
+        repaint();
+        return;
+    }
+
     Atom net_wm_blur_region = XInternAtom(dpy, "_KDE_NET_WM_BLUR_BEHIND_REGION", False);
 
     if (blurEnabled) {
@@ -30,8 +36,8 @@ void DragWidget::blurBackground(bool blurEnabled)
         XDeleteProperty(dpy, this->winId(), net_wm_blur_region);
     }
 
+    XFlush(dpy);
     repaint();
-    XCloseDisplay(dpy);
 }
 void DragWidget::setLocked(bool locked)
 {
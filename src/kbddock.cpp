@@ -24,8 +24,7 @@
 
 #include <QDBusConnection>
 #include <QPainter>
-#include <QGuiApplication>
-#include <QScreen>
+#include <QTimer>
 #include <QWidget>
 #include <QMouseEvent>
 
@@ -34,8 +33,17 @@
 #define DEFAULT_WIDTH 	105
 #define DEFAULT_HEIGHT 	35
 
-KbdDock::KbdDock(const WId& window) : DragWidget(nullptr), wID(window)
+//ms between two thumbnail renders
+#define DOCK_RENDER_INTERVAL 250
+
+KbdDock::KbdDock(QWidget *keyboard) : DragWidget(nullptr), keyboard(keyboard), dirty(true)
 {
+    renderTimer = new QTimer(this);
+    renderTimer->setSingleShot(true);
+    connect(renderTimer, SIGNAL(timeout()), this, SLOT(renderThumbnail()));
+
+    keyboard->installEventFilter(this);
+
     setAttribute(Qt::WA_AlwaysShowToolTips);
     setAttribute(Qt::WA_DeleteOnClose, false);
 
@@ -55,9 +63,63 @@ KbdDock::~KbdDock()
 
 void KbdDock::paintEvent(QPaintEvent *)
 {
-     QPixmap pix = QGuiApplication::primaryScreen()->grabWindow(wID);
      QPainter p(this);
-     p.drawPixmap(0, 0, pix.scaled(width(), height(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+     p.drawPixmap(0, 0, pm);
+}
+
+void KbdDock::setPixmap(const QPixmap& pm)
+{
+    this->pm = pm;
+    update();
+}
+
+void KbdDock::invalidate()
+{
+    dirty = true;
+
+    //hidden docks catch up when shown
+    if (!isVisible() || renderTimer->isActive()) return;
+
+    qint64 wait = 0;
+    if (lastRender.isValid()) {
+        wait = qMax((qint64) 0, DOCK_RENDER_INTERVAL - lastRender.elapsed());
+    }
+    renderTimer->start(wait);
+}
+
+void KbdDock::renderThumbnail()
+{
+    if (!keyboard || !dirty) return;
+
+    dirty = false;
+    lastRender.start();
+
+    //rendered off-screen, no server round trip
+    qreal dpr = devicePixelRatioF();
+    QPixmap thumbnail = keyboard->grab().scaled(size() * dpr, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    thumbnail.setDevicePixelRatio(dpr);
+
+    setPixmap(thumbnail);
+}
+
+void KbdDock::resizeEvent(QResizeEvent *ev)
+{
+    DragWidget::resizeEvent(ev);
+    invalidate();
+}
+
+void KbdDock::showEvent(QShowEvent *ev)
+{
+    DragWidget::showEvent(ev);
+    if (dirty) invalidate();
+}
+
+bool KbdDock::eventFilter(QObject *object, QEvent *ev)
+{
+    if (object == keyboard && (ev->type() == QEvent::Resize || ev->type() == QEvent::LayoutRequest)) {
+        invalidate();
+    }
+    return DragWidget::eventFilter(object, ev);
 }
 
 void KbdDock::mouseReleaseEvent(QMouseEvent *ev)
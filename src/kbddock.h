@@ -25,27 +25,47 @@
 
 #include "dragwidget.h"
 
+#include <QElapsedTimer>
 #include <QPixmap>
+#include <QPointer>
 #include <QMouseEvent>
 
+class QTimer;
+
 class KbdDock : public DragWidget
 {
     Q_OBJECT
 
 public:
-    KbdDock(const WId& window);
+    //shows a thumbnail of the keyboard widget
+    KbdDock(QWidget *keyboard);
     ~KbdDock();
 
     void paintEvent(QPaintEvent *) override;
     void setPixmap(const QPixmap& pm);
 
+public Q_SLOTS:
+    //the keyboard looks different, render the thumbnail again soon
+    void invalidate();
+
+protected Q_SLOTS:
+    void renderThumbnail();
+
 Q_SIGNALS:
     void requestVisibility();
 
 protected:
     void mouseReleaseEvent(QMouseEvent *ev) override;
-    WId wID;
+    void resizeEvent(QResizeEvent *ev) override;
+    void showEvent(QShowEvent *ev) override;
+    bool eventFilter(QObject *object, QEvent *ev) override;
+
+    QPointer<QWidget> keyboard;
     QPixmap pm;
+    bool dirty;
+    //renders are at least DOCK_RENDER_INTERVAL apart
+    QTimer *renderTimer;
+    QElapsedTimer lastRender;
 };
 
 #endif // KBDDOCK_H
@@ -0,0 +1,61 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "keybackgroundcache.h"
+
+#include <QPainter>
+#include <QStyleOptionButton>
+#include <QWidget>
+
+QPixmap KeyBackgroundCache::background(QWidget *styleWidget, int style, QStyle::State state, const QSize& size, qreal dpr)
+{
+    state &= QStyle::State_Sunken | QStyle::State_On | QStyle::State_MouseOver;
+
+    Key key;
+    key.style = style;
+    key.state = (int) state;
+    key.size = size;
+    key.dpr = dpr;
+
+    QHash<Key, QPixmap>::const_iterator itr = pixmaps.constFind(key);
+    if (itr != pixmaps.constEnd()) return itr.value();
+
+    QPixmap pixmap(size * dpr);
+    pixmap.setDevicePixelRatio(dpr);
+    pixmap.fill(Qt::transparent);
+
+    QStyleOptionButton option;
+    option.initFrom(styleWidget);
+    option.rect = QRect(QPoint(0, 0), size);
+    option.state &= ~(QStyle::State_MouseOver | QStyle::State_Sunken | QStyle::State_On | QStyle::State_HasFocus);
+    option.state |= state;
+    if (!(state & QStyle::State_Sunken)) option.state |= QStyle::State_Raised;
+
+    QPainter painter(&pixmap);
+    styleWidget->style()->drawControl(QStyle::CE_PushButtonBevel, &option, &painter, styleWidget);
+    painter.end();
+
+    pixmaps.insert(key, pixmap);
+    return pixmap;
+}
+
+void KeyBackgroundCache::clear()
+{
+    pixmaps.clear();
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEYBACKGROUNDCACHE_H
+#define KEYBACKGROUNDCACHE_H
+
+#include <QHash>
+#include <QPixmap>
+#include <QSize>
+#include <QStyle>
+
+class QWidget;
+
+// Key backgrounds rendered once per style, state, size and device pixel
+// ratio, so painting a key is a pixmap blit plus its label.
+class KeyBackgroundCache
+{
+public:
+    struct Key
+    {
+        int style;
+        int state;
+        QSize size;
+        qreal dpr;
+    };
+
+    //styleWidget is matched against the style sheet, style identifies it;
+    //only the pressed, checked and hover states are kept apart
+    QPixmap background(QWidget *styleWidget, int style, QStyle::State state, const QSize& size, qreal dpr);
+    void clear();
+
+protected:
+    QHash<Key, QPixmap> pixmaps;
+};
+
+inline bool operator==(const KeyBackgroundCache::Key& a, const KeyBackgroundCache::Key& b)
+{
+    return a.style == b.style && a.state == b.state && a.size == b.size && a.dpr == b.dpr;
+}
+
+inline uint qHash(const KeyBackgroundCache::Key& key, uint seed = 0)
+{
+    return qHash(key.style, seed) ^ (qHash(key.state, seed) << 8) ^ qHash((key.size.width() << 16) | key.size.height(), seed) ^ qHash(key.dpr, seed);
+}
+
+#endif // KEYBACKGROUNDCACHE_H
@@ -0,0 +1,57 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "keydescriptor.h"
+
+KeyDescriptor::KeyDescriptor() : button(nullptr), keyCode(0), groupToggle(-1), groupName(-1),
+    action(NoAction), modifier(false)
+{
+}
+
+//theme action names, aliases after the name of their action
+static const struct {
+    const char *name;
+    KeyDescriptor::Action action;
+} action_names[] = {
+    { "toggleVisibility", KeyDescriptor::ToggleVisibility },
+    { "toggleExtension", KeyDescriptor::ToggleExtension },
+    { "togglePart", KeyDescriptor::ToggleExtension },
+    { "shiftText", KeyDescriptor::ShiftText },
+    { "levelThreeText", KeyDescriptor::LevelThreeText }
+};
+
+KeyDescriptor::Action KeyDescriptor::actionFromName(const QString& name)
+{
+    if (name.isEmpty()) return NoAction;
+
+    for (unsigned int a=0; a<sizeof(action_names)/sizeof(action_names[0]); a++) {
+        if (name == QLatin1String(action_names[a].name)) return action_names[a].action;
+    }
+    return UnknownAction;
+}
+
+QString KeyDescriptor::canonicalActionName(const QString& name)
+{
+    Action action = actionFromName(name);
+
+    for (unsigned int a=0; a<sizeof(action_names)/sizeof(action_names[0]); a++) {
+        if (action_names[a].action == action) return QLatin1String(action_names[a].name);
+    }
+    return name;
+}
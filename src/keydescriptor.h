@@ -0,0 +1,65 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEYDESCRIPTOR_H
+#define KEYDESCRIPTOR_H
+
+#include <QString>
+
+class VButton;
+
+// Everything the theme says about a key, read once at load. MainWidget keeps
+// them in one contiguous table per part.
+struct KeyDescriptor
+{
+    enum Action {
+        NoAction = 0,
+        ToggleVisibility,
+        ToggleExtension,
+        ShiftText,
+        LevelThreeText,
+        UnknownAction
+    };
+
+    KeyDescriptor();
+
+    static Action actionFromName(const QString& name);
+    //the name the color styles select on, aliases map to their action's
+    //first name; unknown names are kept
+    static QString canonicalActionName(const QString& name);
+
+    VButton *button;
+    unsigned int keyCode;
+
+    //fixed theme labels, the keymap labels the key when label is empty
+    QString label;
+    QString groupLabel;
+
+    //GroupState group that switches to groupLabel and group whose
+    //state checks the key, -1 for none
+    int groupToggle;
+    int groupName;
+
+    Action action;
+    //part shown and hidden by ToggleExtension
+    QString part;
+    bool modifier;
+};
+
+#endif // KEYDESCRIPTOR_H
@@ -0,0 +1,322 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "keyinjector.h"
+#include "latencystats.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+#include <X11/XKBlib.h>
+
+//idle time before temporary bindings are undone; clients look the keysym
+//up when they handle the event, so the binding has to outlive the keys
+#define BINDING_TIMEOUT 200
+
+KeyInjector::KeyInjector(QObject *parent) : QThread(parent), running(true), sparesStale(false)
+{
+    //opened here, during startup, and used by the injector thread only
+    display = X11Display::openConnection();
+    if (!display) {
+        qWarning() << "Unable to open X display for key injection";
+    }
+}
+
+KeyInjector::~KeyInjector()
+{
+    stop();
+    wait();
+
+    if (display) {
+        releaseBindings();
+        X11Display::closeConnection(display);
+    }
+}
+
+bool KeyInjector::submit(const KeyRequest& request, int reserved)
+{
+    if (!queue.push(request, reserved)) {
+        return false;
+    }
+    pending.release();
+    return true;
+}
+
+bool KeyInjector::submitSequence(const KeySequence& sequence, int reserved)
+{
+    KeyRequest marker;
+    marker.type = KeyRequest::Sequence;
+    marker.keyCode = 0;
+
+    //the marker keeps the sequence in order with single keys
+    QMutexLocker locker(&sequenceLock);
+    if (!queue.push(marker, reserved)) {
+        return false;
+    }
+    sequences.enqueue(sequence);
+    locker.unlock();
+
+    pending.release();
+    return true;
+}
+
+void KeyInjector::stop()
+{
+    running.store(false);
+    pending.release();
+}
+
+bool KeyInjector::ownsKeyCode(unsigned int keyCode) const
+{
+    QMutexLocker locker(&ownedLock);
+    return ownedKeyCodes.contains(keyCode);
+}
+
+void KeyInjector::keymapChanged()
+{
+    QMutexLocker locker(&ownedLock);
+    ownedKeyCodes.clear();
+    sparesStale.store(true);
+}
+
+void KeyInjector::disownKeyCode(unsigned int keyCode)
+{
+    QMutexLocker locker(&ownedLock);
+    ownedKeyCodes.remove(keyCode);
+}
+
+void KeyInjector::run()
+{
+    while (true) {
+        if (bindings.isEmpty()) {
+            pending.acquire();
+        }
+        else if (!pending.tryAcquire(1, BINDING_TIMEOUT)) {
+            releaseBindings();
+            continue;
+        }
+        if (!running.load()) break;
+
+        KeyRequest request;
+        if (!queue.pop(request)) continue;
+
+        if (request.type == KeyRequest::Sequence) {
+            sequenceLock.lock();
+            KeySequence sequence = sequences.dequeue();
+            sequenceLock.unlock();
+
+            injectSequence(sequence);
+            continue;
+        }
+
+        inject(request);
+        if (request.type == KeyRequest::Click || request.type == KeyRequest::Release) {
+            Q_EMIT keySent(request.keyCode);
+        }
+    }
+}
+
+void KeyInjector::inject(const KeyRequest& request)
+{
+    if (!display) return;
+
+    qint64 start = LatencyStats::now();
+
+    if (request.type == KeyRequest::Modifiers) {
+        //only one of latch and lock is in effect at a time
+        if (request.lockModifiers) {
+            XkbLatchModifiers(display, XkbUseCoreKbd, request.affectMask, 0);
+            XkbLockModifiers(display, XkbUseCoreKbd, request.affectMask, request.modifierMask);
+        }
+        else {
+            XkbLockModifiers(display, XkbUseCoreKbd, request.affectMask, 0);
+            XkbLatchModifiers(display, XkbUseCoreKbd, request.affectMask, request.modifierMask);
+        }
+        XFlush(display);
+        return;
+    }
+
+    if (request.type != KeyRequest::Release) {
+        for (int a=0; a<request.modifierCount; a++) {
+            XTestFakeKeyEvent(display, request.modifiers[a], true, 2);
+        }
+        XTestFakeKeyEvent(display, request.keyCode, true, 2);
+    }
+
+    //a held key stays down until its Release, the server repeats it meanwhile
+    if (request.type != KeyRequest::Press) {
+        XTestFakeKeyEvent(display, request.keyCode, false, 2);
+        for (int a=0; a<request.modifierCount; a++) {
+            XTestFakeKeyEvent(display, request.modifiers[a], false, 2);
+        }
+    }
+
+    XFlush(display);
+
+    qint64 end = LatencyStats::now();
+    LatencyStats::record(LatencyStats::Inject, end - start);
+    LatencyStats::record(LatencyStats::TapToInject, end - request.timestamp);
+}
+
+void KeyInjector::injectSequence(const KeySequence& sequence)
+{
+    if (!display) return;
+
+    qint64 start = LatencyStats::now();
+
+    QVectorIterator<KeyRequest> itr(sequence.keys);
+    while (itr.hasNext()) {
+        const KeyRequest& request = itr.next();
+
+        unsigned int keyCode = request.keyCode;
+        if (request.keySym) {
+            keyCode = bindKeySym(request.keySym);
+            if (!keyCode) continue;
+        }
+
+        //no server side delay, the whole batch is one flush
+        for (int a=0; a<request.modifierCount; a++) {
+            XTestFakeKeyEvent(display, request.modifiers[a], true, CurrentTime);
+        }
+        XTestFakeKeyEvent(display, keyCode, true, CurrentTime);
+        XTestFakeKeyEvent(display, keyCode, false, CurrentTime);
+        for (int a=0; a<request.modifierCount; a++) {
+            XTestFakeKeyEvent(display, request.modifiers[a], false, CurrentTime);
+        }
+    }
+
+    XFlush(display);
+
+    LatencyStats::record(LatencyStats::Sequence, LatencyStats::now() - start);
+}
+
+unsigned int KeyInjector::bindKeySym(unsigned long keySym)
+{
+    //the spares of the previous keymap may be real keys now
+    if (sparesStale.exchange(false)) {
+        releaseBindings();
+        spareKeyCodes.clear();
+    }
+
+    unsigned int keyCode = bindings.value(keySym);
+    if (keyCode) return keyCode;
+
+    if (bindings.isEmpty() && spareKeyCodes.isEmpty()) {
+        findSpareKeyCodes();
+    }
+
+    if (spareKeyCodes.isEmpty() && !bindings.isEmpty()) {
+        //all spares are taken, let the typed keys arrive before rebinding
+        XSync(display, False);
+        QThread::msleep(BINDING_TIMEOUT);
+        releaseBindings();
+    }
+
+    while (!spareKeyCodes.isEmpty()) {
+        keyCode = spareKeyCodes.takeFirst();
+
+        //never overwrite a key the keymap gave symbols to since the scan
+        if (mappedKeySym(keyCode) != NoSymbol) {
+            disownKeyCode(keyCode);
+            continue;
+        }
+
+        //same symbol on both levels, so no modifier is needed
+        KeySym keySyms[2] = { (KeySym) keySym, (KeySym) keySym };
+        XChangeKeyboardMapping(display, keyCode, 2, keySyms, 1);
+
+        bindings.insert(keySym, keyCode);
+        return keyCode;
+    }
+
+    qWarning() << "No spare key codes to bind keysym" << Qt::hex << keySym;
+    return 0;
+}
+
+unsigned long KeyInjector::mappedKeySym(unsigned int keyCode)
+{
+    int keySymsPerKeyCode = 0;
+    KeySym *keySyms = XGetKeyboardMapping(display, keyCode, 1, &keySymsPerKeyCode);
+    if (!keySyms) return NoSymbol;
+
+    KeySym keySym = NoSymbol;
+    for (int a=0; a<keySymsPerKeyCode && keySym == NoSymbol; a++) {
+        keySym = keySyms[a];
+    }
+    XFree(keySyms);
+    return keySym;
+}
+
+void KeyInjector::findSpareKeyCodes()
+{
+    spareKeyCodes.clear();
+
+    int minKeyCode, maxKeyCode, keySymsPerKeyCode;
+    XDisplayKeycodes(display, &minKeyCode, &maxKeyCode);
+
+    KeySym *keySyms = XGetKeyboardMapping(display, minKeyCode, maxKeyCode - minKeyCode + 1, &keySymsPerKeyCode);
+    if (!keySyms) return;
+
+    //highest first, those are the least likely to be claimed by a layout
+    for (int keyCode=maxKeyCode; keyCode>=minKeyCode; keyCode--) {
+        bool spare = true;
+        for (int a=0; a<keySymsPerKeyCode; a++) {
+            if (keySyms[(keyCode - minKeyCode) * keySymsPerKeyCode + a] != NoSymbol) {
+                spare = false;
+                break;
+            }
+        }
+        if (spare) spareKeyCodes << keyCode;
+    }
+
+    XFree(keySyms);
+
+    //published before the first binding, so its MappingNotify is known
+    QMutexLocker locker(&ownedLock);
+    ownedKeyCodes.clear();
+    QListIterator<unsigned int> itr(spareKeyCodes);
+    while (itr.hasNext()) {
+        ownedKeyCodes.insert(itr.next());
+    }
+}
+
+void KeyInjector::releaseBindings()
+{
+    if (bindings.isEmpty()) return;
+
+    QHashIterator<unsigned long, unsigned int> itr(bindings);
+    while (itr.hasNext()) {
+        itr.next();
+
+        //a new keymap may have taken the key code over, leave it alone then
+        if (mappedKeySym(itr.value()) != itr.key()) {
+            disownKeyCode(itr.value());
+            continue;
+        }
+
+        KeySym noSymbol = NoSymbol;
+        XChangeKeyboardMapping(display, itr.value(), 1, &noSymbol, 1);
+        spareKeyCodes << itr.value();
+    }
+    bindings.clear();
+
+    XFlush(display);
+}
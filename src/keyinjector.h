@@ -0,0 +1,161 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEYINJECTOR_H
+#define KEYINJECTOR_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <QMutex>
+#include <QQueue>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QVector>
+
+#include <atomic>
+
+#include "x11display.h"
+
+//single producer / single consumer ring buffer, one slot is kept free
+template<typename T, int Capacity>
+class SpscQueue
+{
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    //producer side, fails unless reserved slots stay free after the item
+    bool push(const T& item, int reserved = 0)
+    {
+        const int current = tail.load(std::memory_order_relaxed);
+        const int next = (current + 1) % Capacity;
+        const int used = (current - head.load(std::memory_order_acquire) + Capacity) % Capacity;
+        if (used + reserved >= Capacity - 1) {
+            return false;
+        }
+        items[current] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    //consumer side
+    bool pop(T& item)
+    {
+        const int current = head.load(std::memory_order_relaxed);
+        if (current == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[current];
+        head.store((current + 1) % Capacity, std::memory_order_release);
+        return true;
+    }
+
+protected:
+    T items[Capacity];
+    std::atomic<int> head;
+    std::atomic<int> tail;
+};
+
+struct KeyRequest
+{
+    enum { MaxModifiers = 8 };
+    //a full tap, one half of a held key, new XKB modifier state, or the
+    //marker of the next queued KeySequence
+    enum Type { Click, Press, Release, Modifiers, Sequence };
+
+    Type type;
+    unsigned int keyCode;
+    //sequence keys only: keysym to bind to a spare key code, 0 for none
+    unsigned long keySym;
+    //Modifiers only: latched (or locked) modifiers among affectMask
+    unsigned int modifierMask;
+    unsigned int affectMask;
+    bool lockModifiers;
+    //LatencyStats::tapTimestamp() at submission
+    qint64 timestamp;
+    int modifierCount;
+    unsigned char modifiers[MaxModifiers];
+};
+
+//taps injected back to back with a single flush
+struct KeySequence
+{
+    QVector<KeyRequest> keys;
+};
+
+// Sends the XTest events of queued key requests from its own thread and
+// connection, so the GUI thread never waits on the X server.
+class KeyInjector : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit KeyInjector(QObject *parent = nullptr);
+    ~KeyInjector();
+
+    //called from the GUI thread only; reserved slots are kept free for the
+    //releases of held keys, which are never refused for lack of room
+    bool submit(const KeyRequest& request, int reserved = 0);
+    bool submitSequence(const KeySequence& sequence, int reserved = 0);
+    void stop();
+
+    //spare key codes the injector binds keysyms to, their symbols are not
+    //part of the layout; safe to call from any thread
+    bool ownsKeyCode(unsigned int keyCode) const;
+    //a keymap change the injector did not cause: no key code is owned
+    //until the spares are looked up again before the next binding
+    void keymapChanged();
+
+Q_SIGNALS:
+    //emitted from the injector thread, in submission order, once a key
+    //is up again (Press requests are not reported)
+    void keySent(unsigned int keyCode);
+
+protected:
+    void run() override;
+    void inject(const KeyRequest& request);
+    void injectSequence(const KeySequence& sequence);
+
+    //temporary keysym bindings of key codes that have no symbols
+    unsigned int bindKeySym(unsigned long keySym);
+    void findSpareKeyCodes();
+    void releaseBindings();
+    //first symbol bound to the key code, NoSymbol when it has none
+    unsigned long mappedKeySym(unsigned int keyCode);
+    void disownKeyCode(unsigned int keyCode);
+
+    Display *display;
+
+    SpscQueue<KeyRequest, 256> queue;
+    QSemaphore pending;
+    std::atomic<bool> running;
+
+    QMutex sequenceLock;
+    QQueue<KeySequence> sequences;
+
+    //injector thread only
+    QHash<unsigned long, unsigned int> bindings;
+    QList<unsigned int> spareKeyCodes;
+
+    mutable QMutex ownedLock;
+    QSet<unsigned int> ownedKeyCodes;
+    std::atomic<bool> sparesStale;
+};
+
+#endif // KEYINJECTOR_H
@@ -0,0 +1,154 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "keylabels.h"
+
+KeymapSnapshot::KeymapSnapshot() : minKeyCode(0), keyCodeCount(0), groupCount(0)
+{
+}
+
+void KeymapSnapshot::reset(int minKeyCode, int maxKeyCode, int groupCount)
+{
+    this->minKeyCode = minKeyCode;
+    this->keyCodeCount = maxKeyCode - minKeyCode + 1;
+    this->groupCount = groupCount;
+
+    keysyms.fill(NoSymbol, keyCodeCount * MaxGroups * LevelCount);
+}
+
+KeySym& KeymapSnapshot::keySym(int keyCode, int group, int level)
+{
+    return keysyms[((keyCode - minKeyCode) * MaxGroups + group) * LevelCount + level];
+}
+
+KeySym KeymapSnapshot::keySym(int keyCode, int group, int level) const
+{
+    return keysyms.at(((keyCode - minKeyCode) * MaxGroups + group) * LevelCount + level);
+}
+
+KeyLabelTables::KeyLabelTables() : minKeyCode(0), keyCodeCount(0)
+{
+}
+
+KeyLabelTables KeyLabelTables::build(const KeymapSnapshot& snapshot)
+{
+    KeyLabelTables tables;
+    tables.minKeyCode = snapshot.minKeyCode;
+    tables.keyCodeCount = snapshot.keyCodeCount;
+
+    //the whole keymap in one pass
+    QVector<char32_t> characters(snapshot.keysyms.count());
+    KeySymConvert kconvert;
+    kconvert.convert(snapshot.keysyms.constData(), characters.data(), snapshot.keysyms.count());
+
+    for (int group=0; group<snapshot.groupCount; group++) {
+
+        QVector<uint> labels(snapshot.keyCodeCount * KeymapSnapshot::LevelCount, 0);
+
+        for (int key=0; key<snapshot.keyCodeCount; key++) {
+            for (int level=0; level<KeymapSnapshot::LevelCount; level++) {
+                int entry = (key * KeymapSnapshot::MaxGroups + group) * KeymapSnapshot::LevelCount + level;
+                labels[key * KeymapSnapshot::LevelCount + level] = characters.at(entry);
+            }
+        }
+        tables.groups.append(labels);
+    }
+
+    tables.index = KeySymIndex::build(snapshot);
+    return tables;
+}
+
+bool KeyLabelTables::isEmpty() const
+{
+    return groups.isEmpty();
+}
+
+int KeyLabelTables::groupCount() const
+{
+    return groups.count();
+}
+
+void KeyLabelTables::textForKeyCode(unsigned int keyCode, int group, ButtonText& text) const
+{
+    text.clear();
+
+    int key = (int) keyCode - minKeyCode;
+    if (groups.isEmpty() || key < 0 || key >= keyCodeCount) return;
+
+    //groups beyond the configured ones wrap around like XKB does
+    if (group < 0) group = 0;
+    const QVector<uint>& labels = groups.at(group % groups.count());
+
+    for (int level=0; level<KeymapSnapshot::LevelCount; level++) {
+        text.levels[level] = labels.at(key * KeymapSnapshot::LevelCount + level);
+    }
+}
+
+const KeySymIndex& KeyLabelTables::keySymIndex() const
+{
+    return index;
+}
+
+KeySymIndex KeySymIndex::build(const KeymapSnapshot& snapshot)
+{
+    KeySymIndex index;
+
+    KeySymConvert kconvert;
+
+    for (int group=0; group<snapshot.groupCount; group++) {
+
+        QHash<KeySym, uint> positions;
+        positions.reserve(snapshot.keyCodeCount * 2);
+
+        for (int level=0; level<KeymapSnapshot::LevelCount; level++) {
+            for (int key=0; key<snapshot.keyCodeCount; key++) {
+
+                KeySym keysym = snapshot.keySym(snapshot.minKeyCode + key, group, level);
+                if (keysym == NoSymbol) continue;
+
+                long ucs = kconvert.convert(keysym);
+                if (ucs > 0) {
+                    KeySym canonical = kconvert.keySym(ucs);
+                    if (canonical != NoSymbol) keysym = canonical;
+                }
+
+                if (!positions.contains(keysym)) {
+                    positions.insert(keysym, (uint) (snapshot.minKeyCode + key) << 2 | level);
+                }
+            }
+        }
+        index.groups.append(positions);
+    }
+    return index;
+}
+
+bool KeySymIndex::find(KeySym keysym, int group, KeyPosition& position) const
+{
+    if (groups.isEmpty()) return false;
+
+    if (group < 0) group = 0;
+    const QHash<KeySym, uint>& positions = groups.at(group % groups.count());
+
+    QHash<KeySym, uint>::const_iterator itr = positions.constFind(keysym);
+    if (itr == positions.constEnd()) return false;
+
+    position.keyCode = itr.value() >> 2;
+    position.level = itr.value() & 3;
+    return true;
+}
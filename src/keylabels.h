@@ -0,0 +1,93 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEYLABELS_H
+#define KEYLABELS_H
+
+#include <QHash>
+#include <QVector>
+
+#include "keysymconvert.h"
+#include "vkeyboard.h"
+
+//plain copy of the keysyms of every keycode, group and shift level
+struct KeymapSnapshot
+{
+    enum { MaxGroups = 4, LevelCount = 4 };
+
+    KeymapSnapshot();
+
+    void reset(int minKeyCode, int maxKeyCode, int groupCount);
+    KeySym& keySym(int keyCode, int group, int level);
+    KeySym keySym(int keyCode, int group, int level) const;
+
+    int minKeyCode;
+    int keyCodeCount;
+    int groupCount;
+    QVector<KeySym> keysyms;
+};
+
+struct KeyPosition
+{
+    unsigned int keyCode;
+    int level;
+};
+
+// Where each keysym sits in every group, preferring the lowest level and
+// then the lowest key code. Keysyms of characters are stored in the form
+// KeySymConvert::keySym() gives, so a character has a single key however
+// the layout spells it.
+class KeySymIndex
+{
+public:
+    static KeySymIndex build(const KeymapSnapshot& snapshot);
+
+    bool find(KeySym keysym, int group, KeyPosition& position) const;
+
+protected:
+    //key code << 2 | level
+    QVector< QHash<KeySym, uint> > groups;
+};
+
+// Label characters for every group and level, built once per keymap so a
+// layout or level switch only changes which table is read.
+class KeyLabelTables
+{
+public:
+    KeyLabelTables();
+
+    //converts the whole snapshot, safe to run off the GUI thread
+    static KeyLabelTables build(const KeymapSnapshot& snapshot);
+
+    bool isEmpty() const;
+    int groupCount() const;
+
+    //one entry per level of the given group
+    void textForKeyCode(unsigned int keyCode, int group, ButtonText& text) const;
+
+    const KeySymIndex& keySymIndex() const;
+
+protected:
+    int minKeyCode;
+    int keyCodeCount;
+    QVector< QVector<uint> > groups;
+    KeySymIndex index;
+};
+
+#endif // KEYLABELS_H
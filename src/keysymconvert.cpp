@@ -39,7 +39,9 @@
 struct codepair {
     unsigned short keysym;
     unsigned short ucs;
-} keysymtab[] = {
+};
+
+static constexpr codepair keysymtab[] = {
     { 0x01a1, 0x0104 }, /*                     Aogonek Ą LATIN CAPITAL LETTER A WITH OGONEK */
     { 0x01a2, 0x02d8 }, /*                       breve ˘ BREVE */
     { 0x01a3, 0x0141 }, /*                     Lstroke Ł LATIN CAPITAL LETTER L WITH STROKE */
@@ -815,7 +817,207 @@ struct codepair {
     { 0x20ac, 0x20ac }, /*                    EuroSign € EURO SIGN */
 };
 
+/*
+ * The reverse table is keysymtab[] heap sorted by (ucs, keysym) at compile
+ * time, so several keysyms of one character resolve to the lowest of them.
+ */
+namespace {
+
+constexpr int keysymtabSize = sizeof(keysymtab) / sizeof(struct codepair);
+
+struct UcsTable {
+    codepair pairs[keysymtabSize];
+};
+
+constexpr bool ucsLess(const codepair& a, const codepair& b)
+{
+    return a.ucs < b.ucs || (a.ucs == b.ucs && a.keysym < b.keysym);
+}
+
+constexpr void siftDown(UcsTable& table, int root, int end)
+{
+    while (2 * root + 1 < end) {
+        int child = 2 * root + 1;
+        if (child + 1 < end && ucsLess(table.pairs[child], table.pairs[child + 1]))
+            child++;
+        if (!ucsLess(table.pairs[root], table.pairs[child]))
+            return;
+
+        codepair swap = table.pairs[root];
+        table.pairs[root] = table.pairs[child];
+        table.pairs[child] = swap;
+        root = child;
+    }
+}
+
+constexpr UcsTable sortByUcs()
+{
+    UcsTable table{};
+    for (int i = 0; i < keysymtabSize; i++)
+        table.pairs[i] = keysymtab[i];
+
+    for (int start = keysymtabSize / 2 - 1; start >= 0; start--)
+        siftDown(table, start, keysymtabSize);
+
+    for (int end = keysymtabSize - 1; end > 0; end--) {
+        codepair swap = table.pairs[0];
+        table.pairs[0] = table.pairs[end];
+        table.pairs[end] = swap;
+        siftDown(table, 0, end);
+    }
+    return table;
+}
+
+constexpr bool isSortedByUcs(const UcsTable& table)
+{
+    for (int i = 1; i < keysymtabSize; i++) {
+        if (ucsLess(table.pairs[i], table.pairs[i - 1]))
+            return false;
+    }
+    return true;
+}
+
+constexpr UcsTable ucstab = sortByUcs();
+static_assert(isSortedByUcs(ucstab), "ucstab must be sorted by ucs");
+
+}
+
+/*
+ * Direct lookup table for the 16 bit keysyms: the high byte selects one of
+ * the 256 entry pages, the low byte the entry. Page 0 stays empty for the
+ * unused high bytes, Latin-1 is stored like every other character.
+ */
+namespace {
+
+constexpr bool isLatin1(long keysym)
+{
+    return (keysym >= 0x0020 && keysym <= 0x007e) ||
+           (keysym >= 0x00a0 && keysym <= 0x00ff);
+}
+
+constexpr int pageCount()
+{
+    bool used[256] = {};
+    used[0] = true;
+    for (int i = 0; i < keysymtabSize; i++)
+        used[keysymtab[i].keysym >> 8] = true;
+
+    int count = 1;
+    for (int i = 0; i < 256; i++) {
+        if (used[i])
+            count++;
+    }
+    return count;
+}
+
+constexpr int keysymPageCount = pageCount();
+
+struct KeySymPages {
+    unsigned char index[256];
+    unsigned short ucs[keysymPageCount][256];
+};
+
+constexpr KeySymPages buildPages()
+{
+    KeySymPages pages{};
+    int next = 1;
+
+    pages.index[0] = next++;
+    for (int keysym = 0; keysym < 0x100; keysym++) {
+        if (isLatin1(keysym))
+            pages.ucs[pages.index[0]][keysym] = keysym;
+    }
+
+    for (int i = 0; i < keysymtabSize; i++) {
+        int high = keysymtab[i].keysym >> 8;
+        if (!pages.index[high])
+            pages.index[high] = next++;
+        pages.ucs[pages.index[high]][keysymtab[i].keysym & 0xff] = keysymtab[i].ucs;
+    }
+    return pages;
+}
+
+constexpr KeySymPages keysympages = buildPages();
+
+}
+
+/*
+ * The same two level layout for the other direction, paged by the high
+ * byte of the 16 bit UCS values; page 0 stays empty. Several keysyms of one character resolve to the
+ * lowest of them, as in ucstab.
+ */
+namespace {
+
+constexpr int ucsPageCount()
+{
+    bool used[256] = {};
+    for (int i = 0; i < keysymtabSize; i++)
+        used[keysymtab[i].ucs >> 8] = true;
+
+    int count = 1;
+    for (int i = 0; i < 256; i++) {
+        if (used[i])
+            count++;
+    }
+    return count;
+}
+
+constexpr int ucsPagesCount = ucsPageCount();
+
+struct UcsPages {
+    unsigned char index[256];
+    unsigned short keysym[ucsPagesCount][256];
+};
+
+constexpr UcsPages buildUcsPages()
+{
+    UcsPages pages{};
+    int next = 1;
+
+    for (int i = 0; i < keysymtabSize; i++) {
+        int high = ucstab.pairs[i].ucs >> 8;
+        if (!pages.index[high])
+            pages.index[high] = next++;
+
+        unsigned short& keysym = pages.keysym[pages.index[high]][ucstab.pairs[i].ucs & 0xff];
+        if (!keysym)
+            keysym = ucstab.pairs[i].keysym;
+    }
+    return pages;
+}
+
+constexpr UcsPages ucspages = buildUcsPages();
+
+}
+
 long KeySymConvert::convert(KeySym keysym)
+{
+    /* directly encoded 24-bit UCS characters */
+    if ((keysym & 0xff000000) == 0x01000000)
+        return keysym & 0x00ffffff;
+
+    if (keysym > 0xffff)
+        return -1;
+
+    unsigned short ucs = keysympages.ucs[keysympages.index[keysym >> 8]][keysym & 0xff];
+    return ucs ? ucs : -1;
+}
+
+void KeySymConvert::convert(const KeySym *keysyms, char32_t *ucs, int count)
+{
+    for (int i = 0; i < count; i++) {
+        KeySym keysym = keysyms[i];
+
+        if ((keysym & 0xff000000) == 0x01000000)
+            ucs[i] = keysym & 0x00ffffff;
+        else if (keysym > 0xffff)
+            ucs[i] = 0;
+        else
+            ucs[i] = keysympages.ucs[keysympages.index[keysym >> 8]][keysym & 0xff];
+    }
+}
+
+long KeySymConvert::convertBySearch(KeySym keysym)
 {
     int min = 0;
     int max = sizeof(keysymtab) / sizeof(struct codepair) - 1;
@@ -846,3 +1048,53 @@ long KeySymConvert::convert(KeySym keysym)
     /* no matching Unicode value found */
     return -1;
 }
+
+KeySym KeySymConvert::keySym(long ucs)
+{
+    /* Latin-1 characters have the same keysym value */
+    if (isLatin1(ucs))
+        return ucs;
+
+    /* control characters have no graphical keysym */
+    if (ucs < 0x0020 || (ucs >= 0x007f && ucs < 0x00a0) || ucs > 0x00ffffff)
+        return NoSymbol;
+
+    if (ucs <= 0xffff) {
+        unsigned short keysym = ucspages.keysym[ucspages.index[ucs >> 8]][ucs & 0xff];
+        if (keysym)
+            return keysym;
+    }
+
+    /* everything else is directly encoded */
+    return ucs | 0x01000000;
+}
+
+KeySym KeySymConvert::keySymBySearch(long ucs)
+{
+    int min = 0;
+    int max = keysymtabSize - 1;
+    int mid;
+
+    /* Latin-1 characters have the same keysym value */
+    if ((ucs >= 0x0020 && ucs <= 0x007e) ||
+            (ucs >= 0x00a0 && ucs <= 0x00ff))
+        return ucs;
+
+    /* control characters have no graphical keysym */
+    if (ucs < 0x0020 || (ucs >= 0x007f && ucs < 0x00a0) || ucs > 0x00ffffff)
+        return NoSymbol;
+
+    /* lower bound, the first entry is the lowest keysym */
+    while (min <= max) {
+        mid = (min + max) / 2;
+        if (ucstab.pairs[mid].ucs < ucs)
+            min = mid + 1;
+        else
+            max = mid - 1;
+    }
+    if (min < keysymtabSize && ucstab.pairs[min].ucs == ucs)
+        return ucstab.pairs[min].keysym;
+
+    /* everything else is directly encoded */
+    return ucs | 0x01000000;
+}
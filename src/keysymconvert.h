@@ -1,7 +1,7 @@
 /* $XFree86: xc/programs/xterm/keysym2ucs.h,v 1.1 1999/06/12 15:37:18 dawes Exp $ */
 /*
  * This module converts keysym values into the corresponding ISO 10646-1
- * (UCS, Unicode) values.
+ * (UCS, Unicode) values, and back.
  */
 
 #ifndef KEYSYM2UCS_H
@@ -13,6 +13,16 @@ class KeySymConvert
 {
 public:
     long convert(KeySym keysym);
+    //whole arrays at once, 0 where a keysym has no character
+    void convert(const KeySym *keysyms, char32_t *ucs, int count);
+    //the original binary search over keysymtab, kept as the reference
+    //for the benchmark
+    long convertBySearch(KeySym keysym);
+    //legacy keysym when there is one, the Unicode keysym otherwise,
+    //NoSymbol for control characters
+    KeySym keySym(long ucs);
+    //binary search over ucstab, the reference for the benchmark
+    KeySym keySymBySearch(long ucs);
 };
 
 #endif // KEYSYM2UCS_H
@@ -32,6 +32,8 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QScreen>
+#include <QDBusConnection>
+#include <QDBusMetaType>
 
 #include <KAboutData>
 #include <KConfig>
@@ -47,13 +49,91 @@ QList<VButton*> modKeys;
 #define DEFAULT_WIDTH 	640
 #define DEFAULT_HEIGHT 	210
 
+//hidden parts give back their widgets after this long
+#define PART_RELEASE_DELAY 60000
+
 #include "x11keyboard.h"
+#include "recordingkeyboard.h"
+#ifdef HAVE_WAYLAND
+#include "waylandkeyboard.h"
+#endif
+#include "latencystats.h"
+#include "kvkbdadaptor.h"
+
+void KvkbdApp::setBackend(const QString& name, const QString& keymapFile, const QString& recordLog)
+{
+    backendName = name;
+    recordingKeymap = keymapFile;
+    recordingLog = recordLog;
+}
+
+void KvkbdApp::createBackend()
+{
+    if (backendName == QLatin1String("recording")) {
+        xkbd = new RecordingKeyboard(recordingKeymap, this);
+        if (!recordingLog.isEmpty()) {
+            connect(this, SIGNAL(aboutToQuit()), this, SLOT(writeRecordLog()));
+        }
+        return;
+    }
+
+#ifdef HAVE_WAYLAND
+    //inject natively instead of going through XWayland when a compositor is around
+    bool wayland = backendName == QLatin1String("wayland") || (backendName.isEmpty() && qEnvironmentVariableIsSet("WAYLAND_DISPLAY"));
+    if (wayland) {
+        WaylandKeyboard *wkbd = new WaylandKeyboard(this);
+        if (wkbd->isValid()) {
+            xkbd = wkbd;
+            return;
+        }
+        delete wkbd;
+    }
+#endif
+
+    if (!backendName.isEmpty() && backendName != QLatin1String("x11")) {
+        qWarning() << "Backend" << backendName << "is not available, using x11";
+    }
+    xkbd = new X11Keyboard(this);
+}
+
+void KvkbdApp::writeRecordLog()
+{
+    RecordingKeyboard *recorder = qobject_cast<RecordingKeyboard*>(xkbd);
+    if (recorder) {
+        recorder->writeLog(recordingLog);
+    }
+}
+
+bool KvkbdApp::typeText(const QString& text)
+{
+    return xkbd->typeText(text);
+}
+
+void KvkbdApp::pressKeys(const KeyStrokeList& keys)
+{
+    xkbd->pressKeys(keys);
+}
+
+QStringList KvkbdApp::recordedEvents() const
+{
+    RecordingKeyboard *recorder = qobject_cast<RecordingKeyboard*>(xkbd);
+    if (!recorder) return QStringList();
+
+    return recorder->recordedLines();
+}
 
 void KvkbdApp::initGui(bool loginhelper)
 {
     is_login = loginhelper;
     signalMapper = new QSignalMapper(this);
-    connect(signalMapper, SIGNAL(mappedString(const QString &)), this, SLOT(buttonAction(const QString &)));
+    connect(signalMapper, SIGNAL(mappedInt(int)), this, SLOT(buttonAction(int)));
+    partMapper = new QSignalMapper(this);
+    connect(partMapper, SIGNAL(mappedString(QString)), this, SLOT(togglePart(QString)));
+
+    partReaper = new QTimer(this);
+    partReaper->setSingleShot(true);
+    connect(partReaper, SIGNAL(timeout()), this, SLOT(releaseHiddenParts()));
+    partClock.start();
 
     widget = new ResizableDragWidget(nullptr);
     widget->setContentsMargins(10,10,10,10);
@@ -68,7 +148,7 @@ void KvkbdApp::initGui(bool loginhelper)
 
     widget->setWindowFlags(Qt::ToolTip | Qt::FramelessWindowHint | Qt::BypassWindowManagerHint);
 
-    dock = new KbdDock(widget->winId());
+    dock = new KbdDock(widget);
     connect(dock, SIGNAL(requestVisibility()), widget, SLOT(toggleVisibility()));
 
     tray = new KbdTray(widget);
@@ -78,11 +158,32 @@ void KvkbdApp::initGui(bool loginhelper)
     layout->setContentsMargins(0,0,0,0);
     widget->setLayout(layout);
 
-    xkbd = new X11Keyboard(this);
+    createBackend();
+    connect(xkbd, SIGNAL(layoutUpdated(int,QString)), this, SLOT(layoutUpdated(int,QString)));
+    connect(xkbd, SIGNAL(groupStateChanged(const GroupState&)), this, SLOT(storeGroupState(const GroupState&)));
+    connect(xkbd, SIGNAL(keyProcessComplete(unsigned int)), this, SLOT(keyProcessComplete(unsigned int)));
+
+    //what the dock thumbnail shows
+    connect(xkbd, SIGNAL(layoutUpdated(int,QString)), dock, SLOT(invalidate()));
+    connect(xkbd, SIGNAL(groupStateChanged(const GroupState&)), dock, SLOT(invalidate()));
+    connect(this, SIGNAL(textSwitch(bool)), dock, SLOT(invalidate()));
+    connect(this, SIGNAL(levelThreeSwitch(bool)), dock, SLOT(invalidate()));
+    connect(this, SIGNAL(fontUpdated(const QFont&)), dock, SLOT(invalidate()));
+
+    qDBusRegisterMetaType<KeyStroke>();
+    qDBusRegisterMetaType<KeyStrokeList>();
+
+    new KvkbdAdaptor(this);
+    QDBusConnection session = QDBusConnection::sessionBus();
+    session.registerService(QLatin1String("org.kde.kvkbd"));
+    session.registerObject(QLatin1String("/Kvkbd"), this);
 
     themeLoader = new ThemeLoader(widget);
     connect(themeLoader, SIGNAL(partLoaded(MainWidget*, int, int)), this, SLOT(partLoaded(MainWidget*, int, int)));
-    connect(themeLoader, SIGNAL(buttonLoaded(VButton*)), this, SLOT(buttonLoaded(VButton*)));
+    connect(themeLoader, SIGNAL(buttonLoaded(VButton*, const KeyDescriptor&)), this, SLOT(buttonLoaded(VButton*, const KeyDescriptor&)));
+    connect(themeLoader, SIGNAL(buttonRemoved(VButton*, const KeyDescriptor&)), this, SLOT(buttonRemoved(VButton*, const KeyDescriptor&)));
+    connect(themeLoader, SIGNAL(themeReloaded()), this, SLOT(themeReloaded()));
+    connect(themeLoader, SIGNAL(themeReloaded()), dock, SLOT(invalidate()));
 
     QMenu *cmenu = tray->contextMenu();
 
@@ -128,6 +229,41 @@ void KvkbdApp::initGui(bool loginhelper)
     connect(stickyModKeysAction,SIGNAL(triggered(bool)), this, SLOT(setStickyModKeys(bool)));
     widget->setProperty("stickyModKeys", stickyModKeys);
 
+    bool latchModifiers = cfg.readEntry("latchModifiers", QVariant(false)).toBool();
+    KToggleAction *latchModifiersAction = new KToggleAction(i18nc("@action:inmenu", "Send Modifiers as Keyboard State"), this);
+    latchModifiersAction->setChecked(latchModifiers);
+    cmenu->addAction(latchModifiersAction);
+    connect(latchModifiersAction,SIGNAL(triggered(bool)), this, SLOT(setLatchModifiers(bool)));
+    setLatchModifiers(latchModifiers);
+
+    bool serverKeyRepeat = cfg.readEntry("serverKeyRepeat", QVariant(false)).toBool();
+    KToggleAction *serverKeyRepeatAction = new KToggleAction(i18nc("@action:inmenu", "Server Side Key Repeat"), this);
+    serverKeyRepeatAction->setChecked(serverKeyRepeat);
+    cmenu->addAction(serverKeyRepeatAction);
+    connect(serverKeyRepeatAction,SIGNAL(triggered(bool)), this, SLOT(setServerKeyRepeat(bool)));
+    setServerKeyRepeat(serverKeyRepeat);
+
+    bool repeatAcceleration = cfg.readEntry("repeatAcceleration", QVariant(false)).toBool();
+    KToggleAction *repeatAccelerationAction = new KToggleAction(i18nc("@action:inmenu", "Accelerate Key Repeat"), this);
+    repeatAccelerationAction->setChecked(repeatAcceleration);
+    cmenu->addAction(repeatAccelerationAction);
+    connect(repeatAccelerationAction,SIGNAL(triggered(bool)), this, SLOT(setKeyRepeatAcceleration(bool)));
+    setKeyRepeatAcceleration(repeatAcceleration);
+
+    bool outlineResize = cfg.readEntry("outlineResize", QVariant(false)).toBool();
+    KToggleAction *outlineResizeAction = new KToggleAction(i18nc("@action:inmenu", "Outline While Resizing"), this);
+    outlineResizeAction->setChecked(outlineResize);
+    cmenu->addAction(outlineResizeAction);
+    connect(outlineResizeAction,SIGNAL(triggered(bool)), widget, SLOT(setOutlineResize(bool)));
+    widget->setOutlineResize(outlineResize);
+
+    bool singleWidget = cfg.readEntry("singleWidget", QVariant(false)).toBool();
+    KToggleAction *singleWidgetAction = new KToggleAction(i18nc("@action:inmenu", "Paint Keys in a Single Widget"), this);
+    singleWidgetAction->setChecked(singleWidget);
+    cmenu->addAction(singleWidgetAction);
+    connect(singleWidgetAction,SIGNAL(triggered(bool)), this, SLOT(setSingleWidget(bool)));
+    widget->setProperty("singleWidget", singleWidget);
+
     QFont font = cfg.readEntry("font", widget->font());
     widget->setFont(font);
 
@@ -136,7 +272,7 @@ void KvkbdApp::initGui(bool loginhelper)
     themeLoader->findColorStyles(colors, colorsFilename);
     cmenu->addMenu(colors);
     connect(themeLoader, SIGNAL(colorStyleChanged()), widget, SLOT(repaint()));
-    connect(themeLoader, SIGNAL(colorStyleChanged()), dock, SLOT(repaint()));
+    connect(themeLoader, SIGNAL(colorStyleChanged()), dock, SLOT(invalidate()));
 
     KHelpMenu *helpMenu = new KHelpMenu(widget, KAboutData::applicationData());
     helpMenu->menu()->setIcon(QIcon::fromTheme(QLatin1String("help-about")));
@@ -149,6 +285,7 @@ void KvkbdApp::initGui(bool loginhelper)
     QString themeName = cfg.readEntry("layout", "standard");
     themeLoader->loadTheme(themeName);
     widget->setProperty("layout", themeName);
+    placeParts();
 
     QSize defaultSize(DEFAULT_WIDTH,DEFAULT_HEIGHT);
     QRect screenGeometry = QGuiApplication::primaryScreen()->availableGeometry();
@@ -178,11 +315,6 @@ void KvkbdApp::initGui(bool loginhelper)
 
     widget->show();
 
-    bool extensionVisible = cfg.readEntry("extentVisible", QVariant(true)).toBool();
-    if (!extensionVisible) {
-        toggleExtension();
-    }
-
     setQuitOnLastWindowClosed (is_login);
 
     connect(this, SIGNAL(aboutToQuit()), this, SLOT(storeConfig()));
@@ -222,6 +354,11 @@ void KvkbdApp::storeConfig()
     cfg.writeEntry("geometry", widget->geometry());
     cfg.writeEntry("locked", widget->isLocked());
     cfg.writeEntry("stickyModKeys", widget->property("stickyModKeys"));
+    cfg.writeEntry("latchModifiers", widget->property("latchModifiers").toBool());
+    cfg.writeEntry("serverKeyRepeat", widget->property("serverKeyRepeat").toBool());
+    cfg.writeEntry("repeatAcceleration", widget->property("repeatAcceleration").toBool());
+    cfg.writeEntry("singleWidget", widget->property("singleWidget").toBool());
+    cfg.writeEntry("outlineResize", widget->property("outlineResize").toBool());
 
     cfg.writeEntry("showdock", dock->isVisible());
     cfg.writeEntry("dockGeometry", dock->geometry());
@@ -232,14 +369,85 @@ void KvkbdApp::storeConfig()
     cfg.writeEntry("autoresfont", widget->property("autoresfont").toBool());
     cfg.writeEntry("blurBackground", widget->property("blurBackground").toBool());
 
-    MainWidget *prt = parts.value(QLatin1String("extension"));
-    if (prt) {
-        cfg.writeEntry("extentVisible", prt->isVisible());
+    KConfigGroup partsCfg(KSharedConfig::openConfig(), QLatin1String("Parts"));
+    QVectorIterator<ThemePart> itr(themeLoader->layout().parts);
+    while (itr.hasNext()) {
+        QString partName = itr.next().name;
+        partsCfg.writeEntry(partName, parts.contains(partName) && !hiddenSince.contains(partName));
     }
 
     cfg.sync();
 }
 
+bool KvkbdApp::isAlone() const
+{
+    return is_login;
+}
+
+bool KvkbdApp::isKeyboardVisible() const
+{
+    return widget && widget->isVisible();
+}
+
+void KvkbdApp::setKeyboardVisible(bool visible)
+{
+    if (widget && widget->isVisible() != visible) {
+        widget->toggleVisibility();
+    }
+}
+
+bool KvkbdApp::isKeyboardLocked() const
+{
+    return widget && widget->isLocked();
+}
+
+void KvkbdApp::setKeyboardLocked(bool locked)
+{
+    if (widget) {
+        widget->setLocked(locked);
+    }
+}
+
+QStringList KvkbdApp::latencyStages() const
+{
+    return LatencyStats::stageNames();
+}
+
+QList<double> KvkbdApp::latencyPercentiles(const QString& stage) const
+{
+    QList<double> ret;
+
+    int index = LatencyStats::stageIndex(stage);
+    if (index < 0) return ret;
+
+    const LatencyHistogram& histogram = LatencyStats::histogram((LatencyStats::Stage) index);
+    ret << (double) histogram.count();
+    ret << histogram.percentile(50) / 1000.0;
+    ret << histogram.percentile(95) / 1000.0;
+    ret << histogram.percentile(99) / 1000.0;
+
+    return ret;
+}
+
+QString KvkbdApp::latencyReport() const
+{
+    QString report;
+
+    QStringListIterator itr(LatencyStats::stageNames());
+    while (itr.hasNext()) {
+        QString stage = itr.next();
+        QList<double> values = latencyPercentiles(stage);
+
+        report += QLatin1String("%1: n=%2 p50=%3ms p95=%4ms p99=%5ms\n").arg(stage).arg((qulonglong) values.at(0)).arg(values.at(1)).arg(values.at(2)).arg(values.at(3));
+    }
+    return report;
+}
+
+void KvkbdApp::resetLatencyStats()
+{
+    LatencyStats::reset();
+}
+
 void KvkbdApp::autoResizeFont(bool mode)
 {
     widget->setProperty("autoresfont", QVariant(mode));
@@ -249,6 +457,36 @@ void KvkbdApp::autoResizeFont(bool mode)
 void KvkbdApp::setStickyModKeys(bool mode)
 {
     widget->setProperty("stickyModKeys", QVariant(mode));
+    xkbd->modifiersChanged(mode);
+}
+
+void KvkbdApp::setLatchModifiers(bool mode)
+{
+    widget->setProperty("latchModifiers", QVariant(mode));
+    xkbd->setModifierLatching(mode);
+    xkbd->modifiersChanged(widget->property("stickyModKeys").toBool());
+}
+
+void KvkbdApp::setServerKeyRepeat(bool mode)
+{
+    widget->setProperty("serverKeyRepeat", QVariant(mode));
+    VButton::setServerRepeat(mode);
+}
+
+void KvkbdApp::setKeyRepeatAcceleration(bool mode)
+{
+    widget->setProperty("repeatAcceleration", QVariant(mode));
+    VButton::setRepeatAcceleration(mode);
+}
+
+void KvkbdApp::setSingleWidget(bool mode)
+{
+    widget->setProperty("singleWidget", QVariant(mode));
+
+    QMapIterator<QString, MainWidget*> itr(parts);
+    while (itr.hasNext()) {
+        itr.next().value()->setSingleWidget(mode);
+    }
 }
 
 void KvkbdApp::chooseFont()
@@ -274,26 +512,26 @@ void KvkbdApp::chooseFont()
     }
 }
 
-void KvkbdApp::buttonLoaded(VButton *btn)
+void KvkbdApp::buttonLoaded(VButton *btn, const KeyDescriptor& key)
 {
-    if (btn->property("modifier").toBool() == true) {
+    if (key.modifier) {
         modKeys.append(btn);
+        connect(btn, SIGNAL(toggled(bool)), this, SLOT(modifierToggled()));
     }
     else {
         QObject::connect(btn, SIGNAL(keyClick(unsigned int)), xkbd, SLOT(processKeyPress(unsigned int)) );
+        QObject::connect(btn, SIGNAL(keyDown(unsigned int)), xkbd, SLOT(processKeyDown(unsigned int)) );
+        QObject::connect(btn, SIGNAL(keyUp(unsigned int)), xkbd, SLOT(processKeyUp(unsigned int)) );
     }
-    QString bAction = btn->property("action").toString();
 
-    if (bAction.length()>0) {
-        connect(btn, SIGNAL(clicked()), signalMapper, SLOT(map()));
-        signalMapper->setMapping(btn, bAction);
-        actionButtons.insert(bAction, btn);
+    if (key.action == KeyDescriptor::ToggleExtension) {
+        connect(btn, SIGNAL(clicked()), partMapper, SLOT(map()));
+        partMapper->setMapping(btn, key.part);
     }
-
-    QString tooltip = btn->property("tooltip").toString();
-    if (tooltip.length()>0) {
-        btn->setToolTip(tooltip);
-
+    else if (key.action != KeyDescriptor::NoAction) {
+        connect(btn, SIGNAL(clicked()), signalMapper, SLOT(map()));
+        signalMapper->setMapping(btn, (int) key.action);
+        actionButtons.insert(key.action, btn);
     }
 
 }
@@ -301,31 +539,150 @@ void KvkbdApp::partLoaded(MainWidget *vPart, int total_rows, int total_cols)
 {
     QString partName = vPart->property("part").toString();
 
-    int row_pos = 0;
-    int col_pos = 0;
-
-    if (layoutPosition.count()>0) {
-        QString partName = layoutPosition.keys().at(0);
-        QRect lp = layoutPosition.value(partName);
-        col_pos = lp.width();
-    }
-
-    layout->addWidget(vPart,row_pos,col_pos,total_rows,total_cols);
+    QRect span = layoutPosition.value(partName, QRect(0,0,total_cols,total_rows));
+    layout->addWidget(vPart,span.y(),span.x(),span.height(),span.width());
     parts.insert(partName, vPart);
-    layoutPosition.insert(partName, QRect(col_pos,row_pos,total_cols,total_rows));
 
+    vPart->setKeyboard(xkbd);
+    vPart->setSingleWidget(widget->property("singleWidget").toBool());
     QObject::connect(xkbd, SIGNAL(layoutUpdated(int,QString)), vPart, SLOT(updateLayout(int,QString)));
-    QObject::connect(xkbd, SIGNAL(groupStateChanged(const ModifierGroupStateMap&)), vPart, SLOT(updateGroupState(const ModifierGroupStateMap&)));
-    QObject::connect(xkbd, SIGNAL(keyProcessComplete(unsigned int)), this, SLOT(keyProcessComplete(unsigned int)));
+    QObject::connect(xkbd, SIGNAL(groupStateChanged(const GroupState&)), vPart, SLOT(updateGroupState(const GroupState&)));
 
     QObject::connect(this, SIGNAL(textSwitch(bool)), vPart, SLOT(textSwitch(bool)));
+    QObject::connect(this, SIGNAL(levelThreeSwitch(bool)), vPart, SLOT(levelThreeSwitch(bool)));
     QObject::connect(this, SIGNAL(fontUpdated(const QFont&)), vPart, SLOT(updateFont(const QFont&)));
+
+    syncPart(vPart);
+}
+
+//brings a part created or changed after startup up to the current state
+void KvkbdApp::syncPart(MainWidget *vPart)
+{
+    if (!layoutName.isEmpty()) {
+        vPart->updateLayout(layoutIndex, layoutName);
+    }
+    GroupState groups = groupState;
+    groups.changed = GroupState::AllGroups;
+    vPart->updateGroupState(groups);
+    if (shiftLevel) vPart->textSwitch(true);
+    if (levelThree) vPart->levelThreeSwitch(true);
+}
+
+void KvkbdApp::positionParts()
+{
+    int columns = 0;
+    int rows = 0;
+
+    layoutPosition.clear();
+
+    //each part goes right of the ones before it, or below them
+    QVectorIterator<ThemePart> itr(themeLoader->layout().parts);
+    while (itr.hasNext()) {
+        const ThemePart& part = itr.next();
+
+        int row_pos = 0;
+        int col_pos = columns;
+        if (part.attachment == QLatin1String("bottom")) {
+            row_pos = rows;
+            col_pos = 0;
+        }
+        layoutPosition.insert(part.name, QRect(col_pos,row_pos,part.columns,part.rows));
+
+        columns = qMax(columns, col_pos+part.columns);
+        rows = qMax(rows, row_pos+part.rows);
+    }
+}
+
+void KvkbdApp::placeParts()
+{
+    KConfigGroup cfg(KSharedConfig::openConfig(), QLatin1String("Parts"));
+    //the extension used to be the only part that could be hidden
+    bool extensionVisible = KConfigGroup(KSharedConfig::openConfig(), QLatin1String("General")).readEntry("extentVisible", QVariant(true)).toBool();
+
+    positionParts();
+
+    bool main = true;
+    QVectorIterator<ThemePart> itr(themeLoader->layout().parts);
+    while (itr.hasNext()) {
+        const ThemePart& part = itr.next();
+
+        bool visible = part.visible;
+        if (part.name == QLatin1String("extension")) visible = visible && extensionVisible;
+
+        if (main || cfg.readEntry(part.name, visible)) {
+            showPart(part.name);
+        }
+        main = false;
+    }
+}
+
+void KvkbdApp::themeReloaded()
+{
+    QStringList previousParts = layoutPosition.keys();
+
+    //parts the theme no longer declares
+    QListIterator<MainWidget*> ritr(parts.values());
+    while (ritr.hasNext()) {
+        MainWidget *prt = ritr.next();
+        QString partName = prt->property("part").toString();
+        if (themeLoader->layout().part(partName)) continue;
+
+        hiddenSince.remove(partName);
+        layout->removeWidget(prt);
+        destroyPart(prt);
+    }
+
+    positionParts();
+
+    QMapIterator<QString, MainWidget*> itr(parts);
+    while (itr.hasNext()) {
+        itr.next();
+        MainWidget *prt = itr.value();
+
+        if (!hiddenSince.contains(itr.key())) {
+            QRect span = layoutPosition.value(itr.key());
+            layout->removeWidget(prt);
+            layout->addWidget(prt,span.y(),span.x(), span.height(), span.width());
+        }
+        syncPart(prt);
+    }
+
+    QVectorIterator<ThemePart> pitr(themeLoader->layout().parts);
+    while (pitr.hasNext()) {
+        const ThemePart& part = pitr.next();
+        if (part.visible && !previousParts.contains(part.name)) {
+            showPart(part.name);
+        }
+    }
+}
+
+void KvkbdApp::buttonRemoved(VButton *btn, const KeyDescriptor& key)
+{
+    modKeys.removeAll(btn);
+    actionButtons.remove(key.action, btn);
+}
+
+void KvkbdApp::layoutUpdated(int index, const QString& name)
+{
+    layoutIndex = index;
+    layoutName = name;
+}
+
+void KvkbdApp::storeGroupState(const GroupState& groups)
+{
+    for (int group=0; group<GroupState::GroupCount; group++) {
+        if (groups.isChanged(group)) groupState.set(group, groups.isSet(group));
+    }
 }
 
 void KvkbdApp::keyProcessComplete(unsigned int)
 {
+    LatencyTimer timer(LatencyStats::Complete);
+
     if (widget->property("stickyModKeys").toBool()) return;
 
+    //one modifier state change for all released buttons
+    releasingModifiers = true;
     QListIterator<VButton *> itr(modKeys);
     while (itr.hasNext()) {
         VButton *mod = itr.next();
@@ -333,40 +690,139 @@ void KvkbdApp::keyProcessComplete(unsigned int)
             mod->click();
         }
     }
+    releasingModifiers = false;
+
+    modifierToggled();
+}
+
+void KvkbdApp::modifierToggled()
+{
+    dock->invalidate();
+
+    if (releasingModifiers) return;
+
+    xkbd->modifiersChanged(widget->property("stickyModKeys").toBool());
 }
 
-void KvkbdApp::buttonAction(const QString &action)
+void KvkbdApp::buttonAction(int action)
 {
-    if (QString::compare(action, QLatin1String("toggleVisibility"))==0) {
+    switch (action) {
+    case KeyDescriptor::ToggleVisibility:
         if (!is_login) {
             widget->toggleVisibility();
         }
-    } else if (QString::compare(action, QLatin1String("toggleExtension"))==0) {
-        toggleExtension();
-    } else if (QString::compare(action, QLatin1String("shiftText"))==0) {
-        if (actionButtons.contains(action)) {
-            QList<VButton*> buttons = actionButtons.values(action);
-            QListIterator<VButton *> itr(buttons);
-            bool setShift = false;
-            while (itr.hasNext()) {
-                VButton *btn = itr.next();
-                if (btn->isCheckable() && btn->isChecked()) setShift=true;
-            }
-            Q_EMIT textSwitch(setShift);
+        break;
+    case KeyDescriptor::ShiftText:
+    case KeyDescriptor::LevelThreeText: {
+        QList<VButton*> buttons = actionButtons.values(action);
+        QListIterator<VButton *> itr(buttons);
+        bool setLevel = false;
+        while (itr.hasNext()) {
+            VButton *btn = itr.next();
+            if (btn->isCheckable() && btn->isChecked()) setLevel=true;
+        }
+        if (action == KeyDescriptor::ShiftText) {
+            shiftLevel = setLevel;
+            Q_EMIT textSwitch(setLevel);
+        }
+        else {
+            levelThree = setLevel;
+            Q_EMIT levelThreeSwitch(setLevel);
         }
+        break;
+    }
     }
 }
 
 void KvkbdApp::toggleExtension()
 {
-    MainWidget *prt = parts.value(QLatin1String("extension"));
-    if (prt->isVisible()) {
-        prt->hide();
-        layout->removeWidget(prt);
+    togglePart(QLatin1String("extension"));
+}
+
+void KvkbdApp::togglePart(const QString& partName)
+{
+    MainWidget *prt = parts.value(partName);
+    if (prt && !hiddenSince.contains(partName)) {
+        hidePart(partName);
     } else {
-        QString partName = prt->property("part").toString();
+        showPart(partName);
+    }
+}
+
+void KvkbdApp::showPart(const QString& partName)
+{
+    hiddenSince.remove(partName);
+
+    MainWidget *prt = parts.value(partName);
+    if (!prt) {
+        //created on first show, partLoaded puts it in the layout
+        prt = themeLoader->createPart(partName);
+        if (!prt) return;
+    }
+    else {
         QRect span = layoutPosition.value(partName);
         layout->addWidget(prt,span.y(),span.x(), span.height(), span.width());
-        prt->show();
     }
+    prt->show();
+}
+
+void KvkbdApp::hidePart(const QString& partName)
+{
+    MainWidget *prt = parts.value(partName);
+    if (!prt || hiddenSince.contains(partName)) return;
+
+    prt->hide();
+    layout->removeWidget(prt);
+
+    hiddenSince.insert(partName, partClock.elapsed());
+    if (!partReaper->isActive()) {
+        partReaper->start(PART_RELEASE_DELAY);
+    }
+}
+
+void KvkbdApp::releaseHiddenParts()
+{
+    qint64 now = partClock.elapsed();
+    qint64 next = -1;
+
+    QMutableHashIterator<QString, qint64> itr(hiddenSince);
+    while (itr.hasNext()) {
+        itr.next();
+
+        MainWidget *prt = parts.value(itr.key());
+        qint64 remaining = itr.value() + PART_RELEASE_DELAY - now;
+
+        //a checked modifier has to stay around to be released
+        bool holding = false;
+        QVectorIterator<KeyDescriptor> kitr(prt->keyDescriptors());
+        while (kitr.hasNext()) {
+            const KeyDescriptor& key = kitr.next();
+            if (key.modifier && key.button->isChecked()) holding = true;
+        }
+        if (holding && remaining <= 0) remaining = PART_RELEASE_DELAY;
+
+        if (remaining <= 0) {
+            destroyPart(prt);
+            itr.remove();
+        }
+        else if (next < 0 || remaining < next) {
+            next = remaining;
+        }
+    }
+
+    if (next > 0) {
+        partReaper->start(next);
+    }
+}
+
+void KvkbdApp::destroyPart(MainWidget *vPart)
+{
+    QVectorIterator<KeyDescriptor> itr(vPart->keyDescriptors());
+    while (itr.hasNext()) {
+        const KeyDescriptor& key = itr.next();
+        buttonRemoved(key.button, key);
+    }
+
+    parts.remove(vPart->property("part").toString());
+    vPart->deleteLater();
 }
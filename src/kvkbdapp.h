@@ -24,8 +24,10 @@
 #include <QApplication>
 #include <QSignalMapper>
 #include <QGridLayout>
-#include <QDomNode>
-#include <QDomNamedNodeMap>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QTimer>
 
 #include "resizabledragwidget.h"
 #include "mainwidget.h"
@@ -38,33 +40,90 @@
 class KvkbdApp : public QApplication
 {
     Q_OBJECT
+    Q_PROPERTY(bool alone READ isAlone)
+    Q_PROPERTY(bool visible READ isKeyboardVisible WRITE setKeyboardVisible)
+    Q_PROPERTY(bool locked READ isKeyboardLocked WRITE setKeyboardLocked)
 
 public:
     using QApplication::QApplication;
     ~KvkbdApp();
 
+    //backend name is one of x11, wayland or recording, empty picks automatically
+    void setBackend(const QString& name, const QString& keymapFile = QString(), const QString& recordLog = QString());
     void initGui(bool loginhelper = false);
 
+    bool isAlone() const;
+    bool isKeyboardVisible() const;
+    void setKeyboardVisible(bool visible);
+    bool isKeyboardLocked() const;
+    void setKeyboardLocked(bool locked);
+
+    //D-Bus latency statistics
+    QStringList latencyStages() const;
+    QList<double> latencyPercentiles(const QString& stage) const;
+    QString latencyReport() const;
+    void resetLatencyStats();
+
+    //D-Bus batch injection
+    bool typeText(const QString& text);
+    void pressKeys(const KeyStrokeList& keys);
+
+    //D-Bus log of the recording backend
+    QStringList recordedEvents() const;
+
 public Q_SLOTS:
     void keyProcessComplete(unsigned int);
 
-    void buttonAction(const QString& action);
+    void buttonAction(int action);
     void storeConfig();
     void toggleExtension();
+    void togglePart(const QString& partName);
+    void showPart(const QString& partName);
+    void hidePart(const QString& partName);
 
     void chooseFont();
     void autoResizeFont(bool mode);
     void setStickyModKeys(bool mode);
+    void setLatchModifiers(bool mode);
+    void modifierToggled();
+    void setServerKeyRepeat(bool mode);
+    void setKeyRepeatAcceleration(bool mode);
+    void setSingleWidget(bool mode);
 
     void partLoaded(MainWidget *vPart, int total_rows, int total_cols);
-    void buttonLoaded(VButton *btn);
+    void buttonLoaded(VButton *btn, const KeyDescriptor& key);
+    void buttonRemoved(VButton *btn, const KeyDescriptor& key);
+    void themeReloaded();
+    void writeRecordLog();
+
+protected Q_SLOTS:
+    void layoutUpdated(int index, const QString& name);
+    void storeGroupState(const GroupState& groups);
+    void releaseHiddenParts();
 
 protected:
+    void createBackend();
+    void positionParts();
+    void placeParts();
+    void syncPart(MainWidget *vPart);
+    void destroyPart(MainWidget *vPart);
+
     QMap<QString, QString> colorMap;
     QMap<QString, MainWidget*> parts;
     QMap<QString, QRect> layoutPosition;
     QSignalMapper *signalMapper = nullptr;
-    QMultiMap<QString, VButton*> actionButtons;
+    QSignalMapper *partMapper = nullptr;
+    //hidden parts still holding widgets, by the time they were hidden
+    QHash<QString, qint64> hiddenSince;
+    QElapsedTimer partClock;
+    QTimer *partReaper = nullptr;
+    //state replayed to parts created after startup
+    int layoutIndex = 0;
+    QString layoutName;
+    GroupState groupState;
+    bool shiftLevel = false;
+    bool levelThree = false;
+    QMultiMap<int, VButton*> actionButtons;
     KbdTray *tray = nullptr;
     KbdDock *dock = nullptr;
     VKeyboard *xkbd = nullptr;
@@ -72,9 +131,16 @@ protected:
     ThemeLoader *themeLoader = nullptr;
     ResizableDragWidget *widget = nullptr;
     bool is_login = false;
+    //modifier buttons being unchecked after a key, reported once at the end
+    bool releasingModifiers = false;
+
+    QString backendName;
+    QString recordingKeymap;
+    QString recordingLog;
 
 Q_SIGNALS:
     void textSwitch(bool);
+    void levelThreeSwitch(bool);
     void fontUpdated(const QFont& font);
     void startupCompleted();
 };
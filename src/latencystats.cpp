@@ -0,0 +1,162 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "latencystats.h"
+
+#include <QElapsedTimer>
+
+static const char *stage_names[LatencyStats::StageCount] = {
+    "press",
+    "process",
+    "inject",
+    "tapToInject",
+    "complete",
+    "sequence"
+};
+
+LatencyHistogram LatencyStats::histograms[LatencyStats::StageCount];
+qint64 LatencyStats::tap = 0;
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+int LatencyHistogram::bucketIndex(qint64 usecs)
+{
+    if (usecs < 4) {
+        return usecs < 0 ? 0 : (int) usecs;
+    }
+
+    int msb = 63 - __builtin_clzll((unsigned long long) usecs);
+    int sub = (usecs >> (msb - 2)) & 3;
+    int index = (msb - 1) * 4 + sub;
+
+    return index < BucketCount ? index : BucketCount - 1;
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < 4) {
+        return index;
+    }
+
+    int msb = index / 4 + 1;
+    int sub = index % 4;
+    qint64 lower = (qint64) (4 + sub) << (msb - 2);
+
+    return lower + ((qint64) 1 << (msb - 2)) - 1;
+}
+
+void LatencyHistogram::record(qint64 usecs)
+{
+    buckets[bucketIndex(usecs)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset()
+{
+    for (int a=0; a<BucketCount; a++) {
+        buckets[a].store(0, std::memory_order_relaxed);
+    }
+}
+
+quint64 LatencyHistogram::count() const
+{
+    quint64 total = 0;
+    for (int a=0; a<BucketCount; a++) {
+        total += buckets[a].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    quint64 total = count();
+    if (total == 0) return 0;
+
+    //rank of the sample at the given percentile, 1 based
+    quint64 rank = (quint64) ((p / 100.0) * total + 0.5);
+    if (rank < 1) rank = 1;
+
+    quint64 seen = 0;
+    for (int a=0; a<BucketCount; a++) {
+        seen += buckets[a].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return bucketUpperBound(a);
+        }
+    }
+    return bucketUpperBound(BucketCount - 1);
+}
+
+qint64 LatencyStats::now()
+{
+    static QElapsedTimer clock = [] {
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+
+    return clock.nsecsElapsed() / 1000;
+}
+
+void LatencyStats::record(Stage stage, qint64 usecs)
+{
+    histograms[stage].record(usecs);
+}
+
+void LatencyStats::reset()
+{
+    for (int a=0; a<StageCount; a++) {
+        histograms[a].reset();
+    }
+}
+
+qint64 LatencyStats::tapTimestamp()
+{
+    return tap ? tap : now();
+}
+
+void LatencyStats::setTapTimestamp(qint64 timestamp)
+{
+    tap = timestamp;
+}
+
+QStringList LatencyStats::stageNames()
+{
+    QStringList names;
+    for (int a=0; a<StageCount; a++) {
+        names << QLatin1String(stage_names[a]);
+    }
+    return names;
+}
+
+int LatencyStats::stageIndex(const QString& name)
+{
+    for (int a=0; a<StageCount; a++) {
+        if (name == QLatin1String(stage_names[a])) {
+            return a;
+        }
+    }
+    return -1;
+}
+
+const LatencyHistogram& LatencyStats::histogram(Stage stage)
+{
+    return histograms[stage];
+}
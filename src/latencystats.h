@@ -0,0 +1,110 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include <atomic>
+
+// Fixed-bucket histogram of durations in microseconds. Buckets grow
+// logarithmically with four linear steps per power of two, so any
+// reported percentile is within 25% of the real value.
+class LatencyHistogram
+{
+public:
+    enum { BucketCount = 96 };
+
+    LatencyHistogram();
+
+    //safe to call from any thread
+    void record(qint64 usecs);
+    void reset();
+
+    quint64 count() const;
+    //upper bound of the bucket holding the given percentile (0-100)
+    qint64 percentile(double p) const;
+
+    static int bucketIndex(qint64 usecs);
+    static qint64 bucketUpperBound(int index);
+
+protected:
+    std::atomic<quint32> buckets[BucketCount];
+};
+
+class LatencyStats
+{
+public:
+    enum Stage {
+        Press = 0,      //VButton::mousePressEvent
+        Process,        //VKeyboard::processKeyPress
+        Inject,         //XTest send and flush
+        TapToInject,    //mouse press (or release, or repeat) until the flush is done
+        Complete,       //KvkbdApp::keyProcessComplete
+        Sequence,       //XTest send and flush of a typeText or pressKeys batch
+        StageCount
+    };
+
+    //monotonic time in microseconds
+    static qint64 now();
+
+    static void record(Stage stage, qint64 usecs);
+    static void reset();
+
+    //when the key being sent was tapped, now() when it was not; backends
+    //carry it with the key to record TapToInject
+    static qint64 tapTimestamp();
+    static void setTapTimestamp(qint64 timestamp);
+
+    static QStringList stageNames();
+    static int stageIndex(const QString& name);
+
+    static const LatencyHistogram& histogram(Stage stage);
+
+protected:
+    static LatencyHistogram histograms[StageCount];
+    //GUI thread only, 0 outside of a LatencyTap
+    static qint64 tap;
+};
+
+//records the lifetime of the scope into the given stage
+class LatencyTimer
+{
+public:
+    explicit LatencyTimer(LatencyStats::Stage stage) : stage(stage), start(LatencyStats::now()) {}
+    ~LatencyTimer() { LatencyStats::record(stage, LatencyStats::now() - start); }
+
+protected:
+    LatencyStats::Stage stage;
+    qint64 start;
+};
+
+//marks the keys sent within the scope as tapped at the given time, 0 for
+//keys that were not tapped
+class LatencyTap
+{
+public:
+    explicit LatencyTap(qint64 timestamp) { LatencyStats::setTapTimestamp(timestamp); }
+    ~LatencyTap() { LatencyStats::setTapTimestamp(0); }
+};
+
+#endif // LATENCYSTATS_H
@@ -21,6 +21,7 @@
  */
 
 #include "kvkbdapp.h"
+#include "x11display.h"
 #include <KAboutData>
 #include <KLocalizedString>
 
@@ -40,7 +41,7 @@ void findLoginWindow()
 	Display *dipsy = nullptr;
 	char *win_name = nullptr;
 
-	dipsy = XOpenDisplay(nullptr);
+	dipsy = X11Display::openConnection();
 	if (!dipsy) return;
 
 	scrn = DefaultScreen(dipsy);
@@ -61,11 +62,14 @@ void findLoginWindow()
         }
         XFree(win_name);
 	}
-	XCloseDisplay(dipsy);
+	X11Display::closeConnection(dipsy);
 }
 
 int main(int argc, char **argv)
 {
+    //key injection runs on its own thread and connection
+    XInitThreads();
+
     KvkbdApp app(argc, argv);
 
     KLocalizedString::setApplicationDomain("kvkbd");
@@ -82,11 +86,19 @@ int main(int argc, char **argv)
     QCommandLineParser parser;
     QCommandLineOption loginhelper(QLatin1String("loginhelper"), i18n("Stand alone version for use with KDM or XDM.\n"
                                      "See Kvkbd Handbook for information on how to use this option."));
+    QCommandLineOption backend(QLatin1String("backend"), i18n("Keyboard backend to use: x11, wayland or recording."), QLatin1String("name"));
+    QCommandLineOption keymap(QLatin1String("keymap"), i18n("Fixed keymap file used by the recording backend."), QLatin1String("file"));
+    QCommandLineOption recordLog(QLatin1String("record-log"), i18n("Write the keys recorded by the recording backend to this file on exit, - for standard output."), QLatin1String("file"));
     parser.addHelpOption();
     parser.addVersionOption();
     parser.addOption(loginhelper);
+    parser.addOption(backend);
+    parser.addOption(keymap);
+    parser.addOption(recordLog);
     parser.process(app);
 
+    app.setBackend(parser.value(backend), parser.value(keymap), parser.value(recordLog));
+
     bool is_login = parser.isSet(loginhelper);
     if (!is_login) {
         findLoginWindow();
@@ -1,5 +1,14 @@
 #include "mainwidget.h"
 #include "vbutton.h"
+#include "latencystats.h"
+
+#include <QPainter>
+#include <QStyle>
+#include <QStyleOptionButton>
+#include <QToolTip>
+
+//size of a hit-test grid cell, in pixels
+#define GRID_CELL 32
 
 MainWidget::MainWidget(QWidget *parent) : QWidget(parent)
 {
@@ -11,73 +20,130 @@ void MainWidget::setBaseSize(int w, int h)
     bsize.setHeight(h);
 
 }
-void MainWidget::updateGroupState(const ModifierGroupStateMap& stateMap)
+void MainWidget::addKey(const KeyDescriptor& key)
 {
-    QObjectList buttons = this->children();
-    ModifierGroupStateMapIterator itr(stateMap);
-    QList<QChar> text;
+    int index = keys.count();
+    keys.append(key);
 
-    while (itr.hasNext()) {
-        itr.next();
-        QString group_name = itr.key();
-        bool state = itr.value();
+    if (key.groupToggle >= 0) {
+        toggledKeys[key.groupToggle].append(index);
+    }
+    else if (key.label.isEmpty()) {
+        casedKeys.append(index);
+    }
+    if (key.groupName >= 0) {
+        checkedKeys[key.groupName].append(index);
+    }
+
+    //keys with the same color group and action share the style sheet rules
+    QString styleName = key.button->property("colorGroup").toString() + QLatin1Char('/') + key.button->property("action").toString();
+    int style = styleIds.value(styleName, -1);
+    if (style < 0) {
+        style = styleButtons.count();
+        styleIds.insert(styleName, style);
+        styleButtons.append(nullptr);
+    }
+    keyStyles.append(style);
+
+    key.button->setVisible(!singleWidget);
+    if (singleWidget) {
+        connect(key.button, SIGNAL(toggled(bool)), this, SLOT(update()), Qt::UniqueConnection);
+    }
+}
+
+void MainWidget::clearKeys()
+{
+    pressedKey = -1;
+    hoveredKey = -1;
+    keys.clear();
+    keyStyles.clear();
+    casedKeys.clear();
+    for (int group=0; group<GroupState::GroupCount; group++) {
+        toggledKeys[group].clear();
+        checkedKeys[group].clear();
+    }
+}
+
+const QVector<KeyDescriptor>& MainWidget::keyDescriptors() const
+{
+    return keys;
+}
 
-        for (int a=0; a<buttons.count(); a++) {
+void MainWidget::setKeyboard(VKeyboard *vkbd)
+{
+    keyboard = vkbd;
+}
 
-            VButton *btn = (VButton*)buttons.at(a);
+void MainWidget::updateGroupState(const GroupState& groups)
+{
+    for (int group=0; group<GroupState::GroupCount; group++) {
 
-            QString group_toggle = btn->property("group_toggle").toString();
-            QString btn_group_name = btn->property("group_name").toString();
-            QString group_label = btn->property("group_label").toString();
-            QString label = btn->property("label").toString();
+        if (!groups.isChanged(group)) continue;
+        bool state = groups.isSet(group);
 
-            if (QString::compare(group_toggle,group_name)==0) {
+        const QVector<int>& toggled = toggledKeys[group];
+        for (int a=0; a<toggled.count(); a++) {
+            const KeyDescriptor& key = keys.at(toggled.at(a));
 
-                if (group_label.length()>0 && label.length()>0) {
-                    if (state) {
-                        btn->setText(group_label);
-                    }
-                    else {
-                        btn->setText(label);
-                    }
+            if (key.groupLabel.length()>0 && key.label.length()>0) {
+                if (state) {
+                    key.button->setText(key.groupLabel);
+                }
+                else {
+                    key.button->setText(key.label);
                 }
             }
-            else if (QString::compare(group_name, QLatin1String("capslock"))==0) {
+        }
+
+        if (group == GroupState::CapsLock) {
+            for (int a=0; a<casedKeys.count(); a++) {
+                VButton *btn = keys.at(casedKeys.at(a)).button;
                 btn->setCaps(state);
                 btn->updateText();
             }
+        }
 
-            if (QString::compare(btn_group_name, group_name)==0) {
-                btn->setChecked(state);
-            }
+        const QVector<int>& checked = checkedKeys[group];
+        for (int a=0; a<checked.count(); a++) {
+            keys.at(checked.at(a)).button->setChecked(state);
         }
     }
+
+    if (singleWidget) update();
 }
 
 void MainWidget::textSwitch(bool setShift)
 {
-    QObjectList buttons = this->children();
-
-    for (int a=0; a<buttons.count(); a++) {
-        VButton *btn = (VButton*)buttons.at(a);
+    for (int a=0; a<keys.count(); a++) {
+        VButton *btn = keys.at(a).button;
         btn->setShift(setShift);
         btn->updateText();
     }
 
+    if (singleWidget) update();
 }
-void MainWidget::updateLayout(int, const QString& layout_name)
+void MainWidget::levelThreeSwitch(bool setLevelThree)
 {
-    QObjectList buttons = this->children();
+    for (int a=0; a<keys.count(); a++) {
+        VButton *btn = keys.at(a).button;
+        btn->setLevelThree(setLevelThree);
+        btn->updateText();
+    }
 
-    VKeyboard *vkbd = (VKeyboard*)QObject::sender();
+    if (singleWidget) update();
+}
+void MainWidget::updateLayout(int, const QString& layout_name)
+{
+    VKeyboard *vkbd = keyboard ? keyboard : (VKeyboard*)QObject::sender();
 
-    for (int a=0; a<buttons.count(); a++) {
+    for (int a=0; a<keys.count(); a++) {
 
-        VButton *btn = (VButton*)buttons.at(a);
+        const KeyDescriptor& key = keys.at(a);
+        VButton *btn = key.button;
 
-        if (btn->property("label").toString().length()<1) {
+        if (key.label.length()<1) {
             ButtonText text;
-            vkbd->textForKeyCode(btn->getKeyCode(), text);
+            vkbd->textForKeyCode(key.keyCode, text);
             btn->setButtonText(text);
             btn->updateText();
         }
@@ -86,35 +152,307 @@ void MainWidget::updateLayout(int, const QString& layout_name)
             btn->setText(layout_name);
         }
     }
+
+    if (singleWidget) update();
 }
 
 
-void MainWidget::resizeEvent(QResizeEvent *ev)
+void MainWidget::resizeEvent(QResizeEvent *)
 {
-    const QSize& size = ev->size();
+    relayout();
+}
+
+void MainWidget::relayout()
+{
+    QSize size = this->size();
 
     double dw = (double)size.width() / (double)bsize.width();
     double dh = (double)size.height() / (double)bsize.height();
 
-    QObjectList buttons = this->children();
-    for (int a=0; a<buttons.count(); a++) {
+    keyRects.resize(keys.count());
 
-        VButton *btn = (VButton*)buttons.at(a);
+    for (int a=0; a<keys.count(); a++) {
+
+        VButton *btn = keys.at(a).button;
         const QRect& geom = btn->VRect();
 
-        btn->setGeometry((geom.x() * dw), (geom.y() * dh), (geom.width() * dw), (geom.height() * dh));
+        QRect rect((geom.x() * dw), (geom.y() * dh), (geom.width() * dw), (geom.height() * dh));
+        if (singleWidget) {
+            keyRects[a] = rect;
+        }
+        else {
+            btn->setGeometry(rect);
+        }
+    }
+
+    if (singleWidget) {
+        backgrounds.clear();
+        buildGrid();
+        update();
     }
 
     updateFont(this->parentWidget()->font());
 }
 
+void MainWidget::setSingleWidget(bool mode)
+{
+    if (singleWidget == mode) return;
+
+    if (pressedKey >= 0) {
+        keys.at(pressedKey).button->releaseKey();
+        keys.at(pressedKey).button->setDown(false);
+    }
+    pressedKey = -1;
+    hoveredKey = -1;
+
+    singleWidget = mode;
+    setMouseTracking(mode);
+
+    for (int a=0; a<keys.count(); a++) {
+        VButton *btn = keys.at(a).button;
+        btn->setVisible(!mode);
+        if (mode) {
+            connect(btn, SIGNAL(toggled(bool)), this, SLOT(update()), Qt::UniqueConnection);
+        }
+        else {
+            disconnect(btn, SIGNAL(toggled(bool)), this, SLOT(update()));
+        }
+    }
+
+    if (!mode) {
+        qDeleteAll(styleButtons);
+        styleButtons.fill(nullptr);
+        backgrounds.clear();
+        keyRects.clear();
+        grid.clear();
+    }
+
+    relayout();
+    update();
+}
+
+bool MainWidget::isSingleWidget() const
+{
+    return singleWidget;
+}
+
+void MainWidget::buildGrid()
+{
+    gridColumns = width() / GRID_CELL + 1;
+    gridRows = height() / GRID_CELL + 1;
+
+    grid.clear();
+    grid.resize(gridColumns * gridRows);
+
+    for (int a=0; a<keyRects.count(); a++) {
+        const QRect& rect = keyRects.at(a);
+
+        int left = qBound(0, rect.left() / GRID_CELL, gridColumns - 1);
+        int right = qBound(0, rect.right() / GRID_CELL, gridColumns - 1);
+        int top = qBound(0, rect.top() / GRID_CELL, gridRows - 1);
+        int bottom = qBound(0, rect.bottom() / GRID_CELL, gridRows - 1);
+
+        for (int row=top; row<=bottom; row++) {
+            for (int col=left; col<=right; col++) {
+                grid[row * gridColumns + col].append(a);
+            }
+        }
+    }
+}
+
+int MainWidget::keyAt(const QPoint& pos) const
+{
+    if (!singleWidget || pos.x() < 0 || pos.y() < 0) return -1;
+
+    int col = pos.x() / GRID_CELL;
+    int row = pos.y() / GRID_CELL;
+    if (col >= gridColumns || row >= gridRows) return -1;
+
+    const QVector<int>& cell = grid.at(row * gridColumns + col);
+    for (int a=0; a<cell.count(); a++) {
+        if (keyRects.at(cell.at(a)).contains(pos)) return cell.at(a);
+    }
+    return -1;
+}
+
+void MainWidget::updateKey(int index)
+{
+    if (index >= 0 && index < keyRects.count()) {
+        update(keyRects.at(index));
+    }
+}
+
+VButton *MainWidget::styleButton(int index)
+{
+    VButton *style = styleButtons.at(keyStyles.at(index));
+    if (!style) {
+        const VButton *btn = keys.at(index).button;
+        QString action = btn->property("action").toString();
+
+        style = new VButton(this);
+        style->setProperty("colorGroup", btn->property("colorGroup"));
+        if (action.length()>0) {
+            style->setProperty("action", action);
+        }
+        style->hide();
+        styleButtons[keyStyles.at(index)] = style;
+    }
+    style->ensurePolished();
+    return style;
+}
+
+void MainWidget::paintEvent(QPaintEvent *ev)
+{
+    if (!singleWidget) {
+        QWidget::paintEvent(ev);
+        return;
+    }
+
+    QPainter painter(this);
+
+    for (int a=0; a<keys.count() && a<keyRects.count(); a++) {
+        const QRect& rect = keyRects.at(a);
+        if (!ev->region().intersects(rect)) continue;
+
+        VButton *btn = keys.at(a).button;
+        VButton *style = styleButton(a);
+
+        QStyleOptionButton option;
+        option.initFrom(style);
+        option.rect = rect;
+        option.text = btn->text();
+        option.state &= ~(QStyle::State_MouseOver | QStyle::State_Sunken | QStyle::State_On | QStyle::State_Raised | QStyle::State_HasFocus);
+        option.state |= btn->isDown() ? QStyle::State_Sunken : QStyle::State_Raised;
+        if (btn->isChecked()) option.state |= QStyle::State_On;
+        if (a == hoveredKey) option.state |= QStyle::State_MouseOver;
+
+        //the bevel comes from the cache, only the label is drawn
+        painter.drawPixmap(rect.topLeft(), backgrounds.background(style, keyStyles.at(a), option.state, rect.size(), devicePixelRatioF()));
+
+        option.rect = style->style()->subElementRect(QStyle::SE_PushButtonContents, &option, style);
+        painter.setFont(style->font());
+        style->style()->drawControl(QStyle::CE_PushButtonLabel, &option, &painter, style);
+    }
+}
+
+void MainWidget::mousePressEvent(QMouseEvent *ev)
+{
+    int index = keyAt(ev->pos());
+    if (index < 0 || pressedKey >= 0) {
+        QWidget::mousePressEvent(ev);
+        return;
+    }
+
+    LatencyTimer timer(LatencyStats::Press);
+    qint64 timestamp = LatencyStats::now();
+
+    pressedKey = index;
+    pressedButton = ev->button();
+    VButton *btn = keys.at(index).button;
+    //like VButton, only the left button pushes the key down and clicks it
+    if (pressedButton == Qt::LeftButton) {
+        btn->setDown(true);
+    }
+    btn->pressKey(pressedButton, timestamp);
+    updateKey(index);
+}
+
+void MainWidget::mouseReleaseEvent(QMouseEvent *ev)
+{
+    if (pressedKey < 0 || ev->button() != pressedButton) {
+        QWidget::mouseReleaseEvent(ev);
+        return;
+    }
+
+    int index = pressedKey;
+    pressedKey = -1;
+
+    VButton *btn = keys.at(index).button;
+    btn->releaseKey(LatencyStats::now());
+    btn->setDown(false);
+
+    //a left release over the key clicks it, like a button would
+    if (ev->button() == Qt::LeftButton && keyRects.at(index).contains(ev->pos())) {
+        btn->click();
+    }
+    updateKey(index);
+}
+
+void MainWidget::mouseMoveEvent(QMouseEvent *ev)
+{
+    if (!singleWidget) {
+        QWidget::mouseMoveEvent(ev);
+        return;
+    }
+
+    int index = keyAt(ev->pos());
+    if (index != hoveredKey) {
+        updateKey(hoveredKey);
+        hoveredKey = index;
+        updateKey(hoveredKey);
+    }
+
+    if (pressedKey < 0) QWidget::mouseMoveEvent(ev);
+}
+
+void MainWidget::leaveEvent(QEvent *ev)
+{
+    updateKey(hoveredKey);
+    hoveredKey = -1;
+    QWidget::leaveEvent(ev);
+}
+
+void MainWidget::hideEvent(QHideEvent *ev)
+{
+    //never leave a key down in the server when the part goes away
+    if (pressedKey >= 0) {
+        keys.at(pressedKey).button->releaseKey();
+        keys.at(pressedKey).button->setDown(false);
+        pressedKey = -1;
+    }
+    QWidget::hideEvent(ev);
+}
+
+void MainWidget::changeEvent(QEvent *ev)
+{
+    //a new color style repaints every background
+    if (ev->type() == QEvent::StyleChange) {
+        backgrounds.clear();
+        if (singleWidget) update();
+    }
+    QWidget::changeEvent(ev);
+}
+
+bool MainWidget::event(QEvent *ev)
+{
+    if (singleWidget && ev->type() == QEvent::ToolTip) {
+        QHelpEvent *help = (QHelpEvent*)ev;
+        int index = keyAt(help->pos());
+        if (index >= 0 && keys.at(index).button->toolTip().length()>0) {
+            QToolTip::showText(help->globalPos(), keys.at(index).button->toolTip(), this, keyRects.at(index));
+        }
+        else {
+            QToolTip::hideText();
+            ev->ignore();
+        }
+        return true;
+    }
+    return QWidget::event(ev);
+}
+
 void MainWidget::updateFont(const QFont& widgetFont)
 {
     int fontSize = widgetFont.pointSize();
+    if (fontSize < 1) fontSize = widgetFont.pixelSize();
     if ( parentWidget()->property("autoresfont").toBool() ) {
         fontSize = (8.0 / 500.0) * this->parentWidget()->size().width();
     }
-    QString buttonStyle = QLatin1String("VButton { font-family:'%1'; font-size: %2px; font-weight:%3; font-style: %4; }").arg(widgetFont.family()).arg(fontSize).arg(widgetFont.bold() ? QLatin1String("bold") : QLatin1String("normal")).arg(widgetFont.italic() ? QLatin1String("italic") : QLatin1String("normal"));
-    this->setStyleSheet(buttonStyle);
+    if (fontSize < 1) fontSize = 1;
+
+    //set directly, a style sheet would re-polish every key
+    QFont buttonFont(widgetFont);
+    buttonFont.setPixelSize(fontSize);
+    if (buttonFont == font() && testAttribute(Qt::WA_SetFont)) return;
 
+    setFont(buttonFont);
 }
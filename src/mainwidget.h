@@ -9,10 +9,21 @@
 #include <QFont>
 #include <QSize>
 #include <QResizeEvent>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QHash>
 
+#include <QVector>
 #include "vkeyboard.h"
+#include "keydescriptor.h"
+#include "keybackgroundcache.h"
 
 
+class VButton;
+
+// One part of the keyboard. Keys are VButton children, or in single widget
+// mode hidden VButtons that keep the key state while this widget paints
+// and hit-tests all of them itself.
 class MainWidget : public QWidget
 {
     Q_OBJECT
@@ -21,15 +32,67 @@ public:
     explicit MainWidget(QWidget *parent = nullptr);
     void setBaseSize(int w, int h);
 
+    //the theme's keys, in load order
+    void addKey(const KeyDescriptor& key);
+    void clearKeys();
+    //places the keys for the current size
+    void relayout();
+
+    void setSingleWidget(bool mode);
+    bool isSingleWidget() const;
+    //index of the key at pos in single widget mode, -1 for none
+    int keyAt(const QPoint& pos) const;
+    const QVector<KeyDescriptor>& keyDescriptors() const;
+    //labels keys in updateLayout when it is not called from a signal
+    void setKeyboard(VKeyboard *vkbd);
+
 public Q_SLOTS:
     void textSwitch(bool);
+    void levelThreeSwitch(bool);
     void updateLayout(int, const QString&);
-    void updateGroupState(const ModifierGroupStateMap&);
+    void updateGroupState(const GroupState&);
     void updateFont(const QFont&);
 
 protected:
     void resizeEvent(QResizeEvent *ev) override;
+    void paintEvent(QPaintEvent *ev) override;
+    void mousePressEvent(QMouseEvent *ev) override;
+    void mouseReleaseEvent(QMouseEvent *ev) override;
+    void mouseMoveEvent(QMouseEvent *ev) override;
+    void leaveEvent(QEvent *ev) override;
+    void hideEvent(QHideEvent *ev) override;
+    bool event(QEvent *ev) override;
+    void changeEvent(QEvent *ev) override;
+
+    void buildGrid();
+    //template button of the key's style, created on first use
+    VButton *styleButton(int index);
+    void updateKey(int index);
+
     QSize bsize;
+    VKeyboard *keyboard = nullptr;
+    QVector<KeyDescriptor> keys;
+    //indexes into keys: switched to their group label, checked with the
+    //group, and cased by caps lock
+    QVector<int> toggledKeys[GroupState::GroupCount];
+    QVector<int> checkedKeys[GroupState::GroupCount];
+    QVector<int> casedKeys;
+
+    bool singleWidget = false;
+    //key rects at the current size, and the keys overlapping each grid cell
+    QVector<QRect> keyRects;
+    QVector<QVector<int> > grid;
+    int gridColumns = 0;
+    int gridRows = 0;
+    int pressedKey = -1;
+    Qt::MouseButton pressedButton = Qt::NoButton;
+    int hoveredKey = -1;
+    //styles by "colorGroup/action", the hidden button the color style is
+    //matched on for each, and the style of each key
+    QHash<QString, int> styleIds;
+    QVector<VButton*> styleButtons;
+    QVector<int> keyStyles;
+    KeyBackgroundCache backgrounds;
 };
 
 #endif // MAINWIDGET_H
@@ -0,0 +1,197 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "recordingkeyboard.h"
+#include "latencystats.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include <cstdio>
+
+//key codes the bundled themes give the Caps Lock and Num Lock keys
+#define CAPS_LOCK_KEYCODE 66
+#define NUM_LOCK_KEYCODE  77
+
+RecordingKeyboard::RecordingKeyboard(const QString& keymapFile, QObject *parent) : VKeyboard(parent, false),
+    layoutName(QLatin1String("us"))
+{
+    keys.reserve(4096);
+
+    if (!keymapFile.isEmpty()) {
+        loadKeymap(keymapFile);
+    }
+}
+
+RecordingKeyboard::~RecordingKeyboard()
+{
+}
+
+bool RecordingKeyboard::loadKeymap(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Unable to open keymap file:" << fileName;
+        return false;
+    }
+
+    QTextStream stream(&file);
+    int lineNumber = 0;
+    layoutName = QFileInfo(fileName).baseName();
+
+    while (!stream.atEnd()) {
+        QString line = stream.readLine();
+        lineNumber++;
+
+        int comment = line.indexOf(QLatin1Char('#'));
+        if (comment >= 0) {
+            line.truncate(comment);
+        }
+
+        QStringList fields = line.split(QLatin1Char(' '), Qt::SkipEmptyParts);
+        if (fields.isEmpty()) continue;
+
+        if (fields.first() == QLatin1String("layout")) {
+            if (fields.count() > 1) {
+                layoutName = fields.at(1);
+            }
+            continue;
+        }
+
+        bool ok = false;
+        unsigned int keyCode = fields.takeFirst().toUInt(&ok);
+        if (!ok || fields.isEmpty()) {
+            qWarning() << "Invalid keymap entry at" << fileName << "line" << lineNumber;
+            continue;
+        }
+
+        ButtonText text;
+        QStringListIterator itr(fields);
+        for (int a=0; itr.hasNext() && a<ButtonText::LevelCount; a++) {
+            QString level = itr.next();
+            if (level.startsWith(QLatin1String("U+"))) {
+                text.levels[a] = level.mid(2).toUInt(nullptr, 16);
+            }
+            else {
+                text.levels[a] = level.toUcs4().value(0);
+            }
+        }
+        keymap.insert(keyCode, text);
+    }
+    return true;
+}
+
+void RecordingKeyboard::textForKeyCode(unsigned int keyCode, ButtonText& text)
+{
+    text = keymap.value(keyCode);
+}
+
+void RecordingKeyboard::processKeyPress(unsigned int keyCode)
+{
+    LatencyTimer timer(LatencyStats::Process);
+
+    RecordedKey key;
+    key.timestamp = LatencyStats::now();
+    key.keyCode = keyCode;
+    key.modifiers = checkedModifiers();
+    keys.append(key);
+
+    if (keyCode == CAPS_LOCK_KEYCODE || keyCode == NUM_LOCK_KEYCODE) {
+        int group = (keyCode == CAPS_LOCK_KEYCODE) ? GroupState::CapsLock : GroupState::NumLock;
+        groupState.changed = 0;
+        groupState.set(group, !groupState.isSet(group));
+        Q_EMIT groupStateChanged(groupState);
+    }
+
+    Q_EMIT keyProcessComplete(keyCode);
+}
+
+void RecordingKeyboard::queryModState()
+{
+}
+
+void RecordingKeyboard::start()
+{
+    //a single layout, the one of the keymap file
+    layouts = QStringList(layoutName);
+    layout_index = 0;
+    current_layout = layoutName;
+    currentLayoutReady();
+    Q_EMIT layoutUpdated(layout_index, current_layout);
+
+    groupState.changed = GroupState::AllGroups;
+    Q_EMIT groupStateChanged(groupState);
+}
+
+const QVector<RecordedKey>& RecordingKeyboard::recordedKeys() const
+{
+    return keys;
+}
+
+QStringList RecordingKeyboard::recordedLines() const
+{
+    QStringList lines;
+
+    QVectorIterator<RecordedKey> itr(keys);
+    while (itr.hasNext()) {
+        const RecordedKey& key = itr.next();
+
+        QStringList modifiers;
+        QListIterator<unsigned int> mitr(key.modifiers);
+        while (mitr.hasNext()) {
+            modifiers << QString::number(mitr.next());
+        }
+
+        lines << QString::fromLatin1("%1 %2 %3").arg(key.timestamp).arg(key.keyCode).arg(modifiers.join(QLatin1Char(',')));
+    }
+    return lines;
+}
+
+bool RecordingKeyboard::writeLog(const QString& fileName) const
+{
+    QFile file;
+    bool opened;
+
+    if (fileName == QLatin1String("-")) {
+        opened = file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+    else {
+        file.setFileName(fileName);
+        opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text);
+    }
+
+    if (!opened) {
+        qWarning() << "Unable to write recorded keys to" << fileName;
+        return false;
+    }
+
+    QTextStream stream(&file);
+    QStringListIterator itr(recordedLines());
+    while (itr.hasNext()) {
+        stream << itr.next() << '\n';
+    }
+    return true;
+}
+
+void RecordingKeyboard::clear()
+{
+    keys.clear();
+}
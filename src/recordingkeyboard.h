@@ -0,0 +1,77 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RECORDINGKEYBOARD_H
+#define RECORDINGKEYBOARD_H
+
+#include "vkeyboard.h"
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct RecordedKey
+{
+    //LatencyStats::now() when the key was processed
+    qint64 timestamp;
+    unsigned int keyCode;
+    QList<unsigned int> modifiers;
+};
+
+// Backend that injects nothing. Keys are recorded in memory and labels come
+// from a fixed keymap file, giving a deterministic setup for exercising the
+// GUI without an X server or compositor.
+//
+// Keymap file lines are "<keycode> <level1> [<level2> [<level3> [<level4>]]]",
+// where a level is a single character or U+XXXX; '#' starts a comment.
+// A "layout <name>" line names the layout shown, otherwise the file's base
+// name is used. The keyboard daemon is never asked.
+class RecordingKeyboard : public VKeyboard
+{
+    Q_OBJECT
+
+public:
+    RecordingKeyboard(const QString& keymapFile, QObject *parent = nullptr);
+    ~RecordingKeyboard();
+
+    void textForKeyCode(unsigned int keyCode, ButtonText& text) override;
+
+    const QVector<RecordedKey>& recordedKeys() const;
+    //one "<timestamp us> <keycode> <modifier,...>" line per key
+    QStringList recordedLines() const;
+    bool writeLog(const QString& fileName) const;
+    void clear();
+
+public Q_SLOTS:
+    void processKeyPress(unsigned int) override;
+    void queryModState() override;
+    void start() override;
+
+protected:
+    bool loadKeymap(const QString& fileName);
+
+    QHash<unsigned int, ButtonText> keymap;
+    QString layoutName;
+    QVector<RecordedKey> keys;
+    GroupState groupState;
+};
+
+#endif // RECORDINGKEYBOARD_H
@@ -21,18 +21,50 @@
 
 #include "resizabledragwidget.h"
 
+#include <QGuiApplication>
 #include <QPoint>
 #include <QPainter>
+#include <QRubberBand>
+#include <QScreen>
+#include <QTimer>
+#include <QWindow>
 
 #include <QMouseEvent>
 
 ResizableDragWidget::ResizableDragWidget(QWidget *parent) :
-    DragWidget(parent), doResize(false)
+    DragWidget(parent), doResize(false), outlineResize(false), outline(nullptr)
 {
+    resizeTimer = new QTimer(this);
+    resizeTimer->setSingleShot(true);
+    resizeTimer->setTimerType(Qt::PreciseTimer);
+    connect(resizeTimer, SIGNAL(timeout()), this, SLOT(applyResize()));
 }
 
 ResizableDragWidget::~ResizableDragWidget()
 {
+    delete outline;
+}
+
+void ResizableDragWidget::setOutlineResize(bool mode)
+{
+    outlineResize = mode;
+    this->setProperty("outlineResize", QVariant(mode));
+}
+
+int ResizableDragWidget::frameInterval() const
+{
+    QScreen *screen = windowHandle() ? windowHandle()->screen() : QGuiApplication::primaryScreen();
+    qreal rate = screen ? screen->refreshRate() : 60.0;
+    if (rate < 1.0) rate = 60.0;
+
+    return qMax(1, (int) (1000.0 / rate));
+}
+
+void ResizableDragWidget::applyResize()
+{
+    if (pendingSize.isValid() && pendingSize != size()) {
+        resize(pendingSize);
+    }
 }
 
 void ResizableDragWidget::mousePressEvent(QMouseEvent * ev)
@@ -45,6 +77,7 @@ void ResizableDragWidget::mousePressEvent(QMouseEvent * ev)
         dragPoint = QPoint(width() - ev->pos().x(), height() - ev->pos().y());
         dragged = false;
         doResize = true;
+        pendingSize = size();
     }
 }
 
@@ -61,13 +94,32 @@ void ResizableDragWidget::mouseMoveEvent(QMouseEvent * ev)
     int nw = curr.x() - pos.x() + dragPoint.x();
     int nh = curr.y() - pos.y() + dragPoint.y();
 
-    resize(nw, nh);
+    pendingSize = QSize(nw, nh).expandedTo(minimumSize()).boundedTo(maximumSize());
+
+    if (outlineResize) {
+        if (!outline) {
+            outline = new QRubberBand(QRubberBand::Rectangle);
+        }
+        outline->setGeometry(QRect(pos, pendingSize));
+        outline->show();
+        return;
+    }
+
+    //motion events come faster than frames, relayout once per frame
+    if (!resizeTimer->isActive()) {
+        resizeTimer->start(frameInterval());
+    }
 }
 
 void ResizableDragWidget::mouseReleaseEvent(QMouseEvent * e)
 {
     DragWidget::mouseReleaseEvent(e);
 
+    if (doResize) {
+        resizeTimer->stop();
+        if (outline) outline->hide();
+        applyResize();
+    }
     doResize = false;
 }
 
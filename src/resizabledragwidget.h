@@ -3,6 +3,11 @@
 
 #include "dragwidget.h"
 
+#include <QSize>
+
+class QRubberBand;
+class QTimer;
+
 class ResizableDragWidget : public DragWidget
 {
     Q_OBJECT
@@ -11,13 +16,27 @@ public:
     explicit ResizableDragWidget(QWidget *parent = nullptr);
     ~ResizableDragWidget();
 
+public Q_SLOTS:
+    //show an outline while resizing and relayout only on release
+    void setOutlineResize(bool mode);
+
+protected Q_SLOTS:
+    void applyResize();
+
 protected:
+    int frameInterval() const;
+
     void mouseMoveEvent(QMouseEvent * e) override;
     void mousePressEvent(QMouseEvent * e) override;
     void mouseReleaseEvent(QMouseEvent * e) override;
     void paintEvent(QPaintEvent *e) override;
 
     bool doResize;
+    bool outlineResize;
+    //latest size asked for, applied at most once per frame
+    QSize pendingSize;
+    QTimer *resizeTimer;
+    QRubberBand *outline;
 };
 
 
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Build-time theme compiler: parses each theme XML given on the command line
+// and writes a C++ source with the serialized layouts for compiledTheme().
+//
+// usage: kvkbd_themec <output.cpp> <theme.xml>...
+
+#include "themelayout.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include <cstdio>
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <output.cpp> <theme.xml>...\n", argv[0]);
+        return 1;
+    }
+
+    QString source;
+    QTextStream out(&source);
+
+    out << "// generated by kvkbd_themec, do not edit\n\n";
+    out << "#include \"compiledthemes.h\"\n\n";
+
+    QStringList names;
+
+    for (int a=2; a<argc; a++) {
+        QString fileName = QFile::decodeName(argv[a]);
+
+        QFile themeFile(fileName);
+        if (!themeFile.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "%s: unable to open\n", argv[a]);
+            return 1;
+        }
+
+        ThemeLayout layout;
+        QString error;
+        if (!layout.parseXml(&themeFile, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[a], qPrintable(error));
+            return 1;
+        }
+
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        layout.write(&buffer);
+
+        out << "static const unsigned char theme" << names.count() << "[] = {";
+        for (int b=0; b<data.size(); b++) {
+            if (b % 16 == 0) out << "\n   ";
+            out << " " << (unsigned int) (unsigned char) data.at(b) << ",";
+        }
+        out << "\n};\n\n";
+
+        names << QFileInfo(fileName).completeBaseName();
+    }
+
+    out << "QByteArray compiledTheme(const QString& themeName)\n{\n";
+    for (int a=0; a<names.count(); a++) {
+        out << "    if (themeName == QLatin1String(\"" << names.at(a) << "\")) {\n";
+        out << "        return QByteArray::fromRawData((const char*) theme" << a << ", sizeof(theme" << a << "));\n";
+        out << "    }\n";
+    }
+    out << "    return QByteArray();\n}\n";
+    out.flush();
+
+    QFile outFile(QFile::decodeName(argv[1]));
+    if (!outFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        fprintf(stderr, "%s: unable to write\n", argv[1]);
+        return 1;
+    }
+    outFile.write(source.toUtf8());
+    return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "themelayout.h"
+
+#include <QDataStream>
+#include <QHash>
+#include <QStringList>
+#include <QXmlStreamReader>
+
+#define DEFAULT_KEY_SIZE 25
+
+ThemeKey::ThemeKey() : keyCode(0), modifier(false), checkable(false), accelerate(false)
+{
+}
+
+ThemePart::ThemePart() : visible(true), rows(0), columns(0)
+{
+}
+
+enum KeyAttribute {
+    CodeAttribute,
+    NameAttribute,
+    LabelAttribute,
+    GroupLabelAttribute,
+    GroupToggleAttribute,
+    GroupNameAttribute,
+    ColorGroupAttribute,
+    TooltipAttribute,
+    ActionAttribute,
+    PartAttribute,
+    ModifierAttribute,
+    CheckableAttribute,
+    AccelerateAttribute,
+    WidthAttribute,
+    HeightAttribute,
+    UnknownAttribute
+};
+
+static const struct {
+    const char *name;
+    KeyAttribute attribute;
+} knownAttributes[] = {
+    { "code", CodeAttribute },
+    { "name", NameAttribute },
+    { "label", LabelAttribute },
+    { "group_label", GroupLabelAttribute },
+    { "group_toggle", GroupToggleAttribute },
+    { "group_name", GroupNameAttribute },
+    { "colorGroup", ColorGroupAttribute },
+    { "tooltip", TooltipAttribute },
+    { "action", ActionAttribute },
+    { "part", PartAttribute },
+    { "modifier", ModifierAttribute },
+    { "checkable", CheckableAttribute },
+    { "accelerate", AccelerateAttribute },
+    { "width", WidthAttribute },
+    { "height", HeightAttribute }
+};
+
+static KeyAttribute keyAttribute(const QXmlStreamAttribute& attribute)
+{
+    for (unsigned int a=0; a<sizeof(knownAttributes)/sizeof(knownAttributes[0]); a++) {
+        if (attribute.name() == QLatin1String(knownAttributes[a].name)) return knownAttributes[a].attribute;
+    }
+    return UnknownAttribute;
+}
+
+//hint sections of the theme
+enum HintSection { NoHints, WidthHints, HeightHints, SpacingHints };
+
+//layout position within a part being read
+struct PartCursor
+{
+    int index;
+    int sx;
+    int sy;
+    int maxSx;
+    int rowHeight;
+    int rowButtons;
+    bool inRow;
+};
+
+// Theme documents are read in one pass: the size hints come before the
+// parts, so every key rect is resolved as soon as its element is seen.
+bool ThemeLayout::parseXml(QIODevice *device, QString *error)
+{
+    QXmlStreamReader reader(device);
+
+    int defaultWidth = DEFAULT_KEY_SIZE;
+    int defaultHeight = DEFAULT_KEY_SIZE;
+
+    QHash<QString, int> widthHints;
+    QHash<QString, int> heightHints;
+    QHash<QString, int> spacingHints;
+
+    HintSection section = NoHints;
+    QVector<PartCursor> cursors;
+
+    parts.clear();
+
+    while (!reader.atEnd()) {
+        QXmlStreamReader::TokenType token = reader.readNext();
+
+        if (token == QXmlStreamReader::EndElement) {
+            const auto tag = reader.name();
+
+            if (tag == QLatin1String("buttonWidth") || tag == QLatin1String("buttonHeight") || tag == QLatin1String("spacingHints")) {
+                section = NoHints;
+            }
+            else if (tag == QLatin1String("row") && !cursors.isEmpty() && cursors.last().inRow) {
+                PartCursor& cursor = cursors.last();
+                ThemePart& part = parts[cursor.index];
+
+                if (cursor.sx>cursor.maxSx) cursor.maxSx = cursor.sx;
+                cursor.sy += cursor.rowHeight;
+                cursor.sx = 0;
+                cursor.inRow = false;
+
+                if (cursor.rowButtons>part.columns) part.columns = cursor.rowButtons;
+            }
+            else if ((tag == QLatin1String("part") || tag == QLatin1String("extension")) && !cursors.isEmpty()) {
+                PartCursor cursor = cursors.takeLast();
+                parts[cursor.index].baseSize = QSize(cursor.maxSx, cursor.sy);
+            }
+            continue;
+        }
+
+        if (token != QXmlStreamReader::StartElement) continue;
+
+        const auto tag = reader.name();
+        QXmlStreamAttributes attributes = reader.attributes();
+
+        if (tag == QLatin1String("buttonWidth")) {
+            section = WidthHints;
+            int width = attributes.value(QLatin1String("width")).toInt();
+            if (width > 0) defaultWidth = width;
+        }
+        else if (tag == QLatin1String("buttonHeight")) {
+            //the height attribute is not a default, keys stay square by default
+            section = HeightHints;
+        }
+        else if (tag == QLatin1String("spacingHints")) {
+            section = SpacingHints;
+        }
+        else if (tag == QLatin1String("item") && section != NoHints) {
+            QString hintName = attributes.value(QLatin1String("name")).toString();
+            if (section == WidthHints) {
+                widthHints.insert(hintName, attributes.value(QLatin1String("width")).toInt());
+            }
+            else if (section == HeightHints) {
+                heightHints.insert(hintName, attributes.value(QLatin1String("height")).toInt());
+            }
+            else {
+                spacingHints.insert(hintName, attributes.value(QLatin1String("width")).toInt());
+            }
+        }
+        else if (tag == QLatin1String("part") || tag == QLatin1String("extension")) {
+            bool isPart = (tag == QLatin1String("part"));
+
+            //parts are top level, extensions only nest in a part
+            if ((isPart && !cursors.isEmpty()) || (!isPart && cursors.count() != 1)) {
+                reader.skipCurrentElement();
+                continue;
+            }
+
+            ThemePart part;
+            part.name = attributes.value(QLatin1String("name")).toString();
+            part.attachment = attributes.value(QLatin1String("attachment")).toString();
+            if (attributes.hasAttribute(QLatin1String("visible"))) {
+                part.visible = attributes.value(QLatin1String("visible")).toInt() > 0;
+            }
+
+            if (parts.isEmpty()) {
+                part.name = QLatin1String("main");
+            }
+            else if (part.name.isEmpty() || this->part(part.name)) {
+                part.name = isPart ? QString::fromLatin1("part%1").arg(parts.count()) : QString(QLatin1String("extension"));
+            }
+            if (this->part(part.name)) {
+                reader.raiseError(QString::fromLatin1("duplicate part name %1").arg(part.name));
+                break;
+            }
+            parts.append(part);
+
+            PartCursor cursor = { parts.count()-1, 0, 0, 0, defaultHeight, 0, false };
+            cursors.append(cursor);
+        }
+        else if (tag == QLatin1String("row") && !cursors.isEmpty()) {
+            PartCursor& cursor = cursors.last();
+            parts[cursor.index].rows++;
+
+            cursor.inRow = true;
+            cursor.rowButtons = 0;
+            cursor.rowHeight = heightHints.value(attributes.value(QLatin1String("height")).toString(), defaultHeight);
+        }
+        else if (tag == QLatin1String("key") && !cursors.isEmpty() && cursors.last().inRow) {
+            PartCursor& cursor = cursors.last();
+
+            ThemeKey key;
+            int buttonWidth = defaultWidth;
+            int buttonHeight = defaultHeight;
+
+            QVectorIterator<QXmlStreamAttribute> itr(attributes);
+            while (itr.hasNext()) {
+                const QXmlStreamAttribute& attribute = itr.next();
+
+                switch (keyAttribute(attribute)) {
+                case CodeAttribute: key.keyCode = attribute.value().toUInt(); break;
+                case NameAttribute: key.name = attribute.value().toString(); break;
+                case LabelAttribute: key.label = attribute.value().toString(); break;
+                case GroupLabelAttribute: key.groupLabel = attribute.value().toString(); break;
+                case GroupToggleAttribute: key.groupToggle = attribute.value().toString(); break;
+                case GroupNameAttribute: key.groupName = attribute.value().toString(); break;
+                case ColorGroupAttribute: key.colorGroup = attribute.value().toString(); break;
+                case TooltipAttribute: key.tooltip = attribute.value().toString(); break;
+                case ActionAttribute: key.action = attribute.value().toString(); break;
+                case PartAttribute: key.part = attribute.value().toString(); break;
+                case ModifierAttribute: key.modifier = attribute.value().toInt() > 0; break;
+                case CheckableAttribute: key.checkable = attribute.value().toInt() > 0; break;
+                case AccelerateAttribute: key.accelerate = attribute.value().toInt() > 0; break;
+                case WidthAttribute: buttonWidth = widthHints.value(attribute.value().toString(), defaultWidth); break;
+                case HeightAttribute: buttonHeight = heightHints.value(attribute.value().toString(), defaultHeight); break;
+                case UnknownAttribute: break;
+                }
+            }
+
+            key.rect = QRect(cursor.sx, cursor.sy, buttonWidth, buttonHeight);
+            parts[cursor.index].keys.append(key);
+
+            cursor.sx += buttonWidth;
+            cursor.rowButtons++;
+        }
+        else if (tag == QLatin1String("spacing") && !cursors.isEmpty() && cursors.last().inRow) {
+            PartCursor& cursor = cursors.last();
+
+            cursor.sx += spacingHints.value(attributes.value(QLatin1String("width")).toString(), 0);
+
+            QString heightHint = attributes.value(QLatin1String("height")).toString();
+            if (heightHints.contains(heightHint)) {
+                int spacingHeight = heightHints.value(heightHint);
+                if (spacingHeight>cursor.rowHeight) cursor.rowHeight = spacingHeight;
+            }
+        }
+    }
+
+    if (reader.hasError()) {
+        if (error) *error = QString::fromLatin1("line %1: %2").arg(reader.lineNumber()).arg(reader.errorString());
+        parts.clear();
+        return false;
+    }
+    if (parts.isEmpty()) {
+        if (error) *error = QString::fromLatin1("line %1: no part element").arg(reader.lineNumber());
+        return false;
+    }
+    return true;
+}
+
+//strings are written once and referenced by index
+bool ThemeLayout::write(QIODevice *device) const
+{
+    QStringList strings;
+    QHash<QString, quint32> stringIds;
+
+    auto intern = [&](const QString& text) -> quint32 {
+        if (!stringIds.contains(text)) {
+            stringIds.insert(text, strings.count());
+            strings << text;
+        }
+        return stringIds.value(text);
+    };
+
+    //interned ahead, so the string table comes before the keys
+    QVectorIterator<ThemePart> pitr(parts);
+    while (pitr.hasNext()) {
+        const ThemePart& part = pitr.next();
+        intern(part.name);
+        intern(part.attachment);
+
+        QVectorIterator<ThemeKey> kitr(part.keys);
+        while (kitr.hasNext()) {
+            const ThemeKey& key = kitr.next();
+            intern(key.name);
+            intern(key.label);
+            intern(key.groupLabel);
+            intern(key.groupToggle);
+            intern(key.groupName);
+            intern(key.colorGroup);
+            intern(key.tooltip);
+            intern(key.action);
+            intern(key.part);
+        }
+    }
+
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_5_9);
+
+    stream << (quint32) Magic << (quint16) FormatVersion;
+    stream << strings;
+    stream << (quint32) parts.count();
+
+    pitr.toFront();
+    while (pitr.hasNext()) {
+        const ThemePart& part = pitr.next();
+
+        stream << stringIds.value(part.name) << stringIds.value(part.attachment) << part.visible;
+        stream << part.baseSize << (qint32) part.rows << (qint32) part.columns;
+        stream << (quint32) part.keys.count();
+
+        QVectorIterator<ThemeKey> kitr(part.keys);
+        while (kitr.hasNext()) {
+            const ThemeKey& key = kitr.next();
+
+            quint8 flags = (key.modifier ? 1 : 0) | (key.checkable ? 2 : 0) | (key.accelerate ? 4 : 0);
+
+            stream << key.rect << (quint32) key.keyCode << flags;
+            stream << stringIds.value(key.name) << stringIds.value(key.label) << stringIds.value(key.groupLabel)
+                   << stringIds.value(key.groupToggle) << stringIds.value(key.groupName) << stringIds.value(key.colorGroup)
+                   << stringIds.value(key.tooltip) << stringIds.value(key.action) << stringIds.value(key.part);
+        }
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool ThemeLayout::read(QIODevice *device)
+{
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_5_9);
+
+    quint32 magic;
+    quint16 version;
+    stream >> magic >> version;
+    if (magic != Magic || version != FormatVersion) return false;
+
+    QStringList strings;
+    stream >> strings;
+
+    auto string = [&](quint32 id) -> QString {
+        return strings.value(id);
+    };
+
+    quint32 partCount;
+    stream >> partCount;
+
+    parts.clear();
+    for (quint32 a=0; a<partCount && stream.status() == QDataStream::Ok; a++) {
+        ThemePart part;
+        quint32 name, attachment, keyCount;
+        qint32 rows, columns;
+
+        stream >> name >> attachment >> part.visible;
+        stream >> part.baseSize >> rows >> columns >> keyCount;
+        part.name = string(name);
+        part.attachment = string(attachment);
+        part.rows = rows;
+        part.columns = columns;
+
+        part.keys.resize(keyCount);
+        for (quint32 b=0; b<keyCount && stream.status() == QDataStream::Ok; b++) {
+            ThemeKey& key = part.keys[b];
+
+            quint32 keyCode;
+            quint8 flags;
+            quint32 ids[9];
+
+            stream >> key.rect >> keyCode >> flags;
+            for (int c=0; c<9; c++) stream >> ids[c];
+
+            key.keyCode = keyCode;
+            key.modifier = flags & 1;
+            key.checkable = flags & 2;
+            key.accelerate = flags & 4;
+
+            key.name = string(ids[0]);
+            key.label = string(ids[1]);
+            key.groupLabel = string(ids[2]);
+            key.groupToggle = string(ids[3]);
+            key.groupName = string(ids[4]);
+            key.colorGroup = string(ids[5]);
+            key.tooltip = string(ids[6]);
+            key.action = string(ids[7]);
+            key.part = string(ids[8]);
+        }
+        parts.append(part);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+const ThemePart* ThemeLayout::part(const QString& name) const
+{
+    for (int a=0; a<parts.count(); a++) {
+        if (parts.at(a).name == name) return &parts.at(a);
+    }
+    return nullptr;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef THEMELAYOUT_H
+#define THEMELAYOUT_H
+
+#include <QIODevice>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+//one key with its geometry resolved against the theme's size hints
+struct ThemeKey
+{
+    ThemeKey();
+
+    QRect rect;
+    unsigned int keyCode;
+
+    QString name;
+    QString label;
+    QString groupLabel;
+    QString groupToggle;
+    QString groupName;
+    QString colorGroup;
+    QString tooltip;
+    QString action;
+    //panel toggled by the toggleExtension action
+    QString part;
+
+    bool modifier;
+    bool checkable;
+    bool accelerate;
+};
+
+struct ThemePart
+{
+    ThemePart();
+
+    QString name;
+    //right or bottom of the panels declared before it
+    QString attachment;
+    //shown unless the user has hidden it
+    bool visible;
+    QSize baseSize;
+    int rows;
+    int columns;
+    QVector<ThemeKey> keys;
+};
+
+// A keyboard theme independent of any widget. It is parsed from the theme
+// XML, or read from the binary form kvkbd_themec compiles the bundled
+// themes into at build time.
+class ThemeLayout
+{
+public:
+    enum { Magic = 0x4b564b4c, FormatVersion = 2 };
+
+    bool parseXml(QIODevice *device, QString *error = nullptr);
+
+    bool read(QIODevice *device);
+    bool write(QIODevice *device) const;
+
+    const ThemePart* part(const QString& name) const;
+
+    //the first one is the main part
+    QVector<ThemePart> parts;
+};
+
+#endif // THEMELAYOUT_H
@@ -19,28 +19,36 @@
  */
 
 #include "themeloader.h"
+#include "compiledthemes.h"
 
 #include <QActionGroup>
+#include <QStyle>
 #include <QApplication>
+#include <QBuffer>
+#include <QDebug>
 #include <QMessageBox>
 #include <QString>
 #include <QFile>
-#include <QDomDocument>
-#include <QDomElement>
-#include <QDomNode>
-#include <QDomNodeList>
 #include <QFileInfo>
+#include <QHash>
 #include <QDir>
 #include <QMenu>
 #include <QStandardPaths>
 
-int defaultWidth = 25;
-int defaultHeight = 25;
-
 #define DEFAULT_CSS QLatin1String(":/colors/standard.css")
 
+//ms to wait for a theme or color file being saved to settle
+#define RELOAD_DELAY 100
+
 ThemeLoader::ThemeLoader(QWidget *parent) : QObject(parent)
 {
+    watcher = new QFileSystemWatcher(this);
+    connect(watcher, SIGNAL(fileChanged(QString)), this, SLOT(fileChanged(QString)));
+
+    reloadTimer = new QTimer(this);
+    reloadTimer->setSingleShot(true);
+    reloadTimer->setInterval(RELOAD_DELAY);
+    connect(reloadTimer, SIGNAL(timeout()), this, SLOT(reloadFiles()));
 }
 
 ThemeLoader::~ThemeLoader()
@@ -49,14 +57,21 @@ ThemeLoader::~ThemeLoader()
 
 void ThemeLoader::loadTheme(QString& themeName)
 {
-    bool loading = true;
-    while (loading) {
-        int ret = this->loadLayout(themeName, QLatin1String(":/themes/"));
-        if (ret == 0) {
-            break;
-        }
-        themeName = QLatin1String("standard");
-    }
+    if (this->loadLayout(themeName) == 0) return;
+
+    themeName = QLatin1String("standard");
+    this->loadLayout(themeName);
+}
+QString ThemeLoader::themeFilePath(const QString& themeName)
+{
+    //user themes take precedence over the site wide ones
+    return QStandardPaths::locate(QStandardPaths::GenericDataLocation, QLatin1String("kvkbd/themes/%1.xml").arg(themeName));
+}
+QString ThemeLoader::userThemeFilePath(const QString& themeName)
+{
+    QDir dataDir(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation));
+    QString fileName = dataDir.filePath(QLatin1String("kvkbd/themes/%1.xml").arg(themeName));
+    return QFile::exists(fileName) ? fileName : QString();
 }
 void ThemeLoader::loadColorFile(const QString& fileName)
 {
@@ -74,6 +89,14 @@ void ThemeLoader::loadColorFile(const QString& fileName)
     ((QWidget*)parent())->setProperty("colors", fileName);
     themeFile.close();
 
+    if (fileName != colorFile) {
+        if (!colorFile.isEmpty() && watcher->files().contains(colorFile)) {
+            watcher->removePath(colorFile);
+        }
+        colorFile = fileName;
+        watchFile(colorFile);
+    }
+
     ((QWidget*)parent())->repaint();
 
     Q_EMIT colorStyleChanged();
@@ -94,11 +117,33 @@ void ThemeLoader::findColorStyles(QMenu *colors, const QString& configSelectedSt
     colors->setIcon(QIcon::fromTheme(QLatin1String("preferences-desktop-color")));
 
     QDir colors_dir(QLatin1String(":/colors"), QLatin1String("*.css"), QDir::Name, QDir::Files | QDir::Readable);
-    QFileInfoList list = colors_dir.entryInfoList();
-    QListIterator<QFileInfo> itr(list);
+
+    //one style per name, sorted by name
+    QMap<QString, QFileInfo> styles;
+    QListIterator<QFileInfo> litr(colors_dir.entryInfoList());
+    while (litr.hasNext()) {
+        QFileInfo fileInfo = litr.next();
+        styles.insert(fileInfo.baseName(), fileInfo);
+    }
+
+    //site and then user color styles, editable while kvkbd runs; each
+    //replaces the style of the same name found before it, the installed
+    //copies of the bundled styles included
+    QStringListIterator ditr(QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, QLatin1String("kvkbd/colors"), QStandardPaths::LocateDirectory));
+    ditr.toBack();
+    while (ditr.hasPrevious()) {
+        colors_dir.setPath(ditr.previous());
+        QListIterator<QFileInfo> fitr(colors_dir.entryInfoList());
+        while (fitr.hasNext()) {
+            QFileInfo fileInfo = fitr.next();
+            styles.insert(fileInfo.baseName(), fileInfo);
+        }
+    }
+
+    QMapIterator<QString, QFileInfo> itr(styles);
     while (itr.hasNext()) {
-        QFileInfo fileInfo = itr.next();
-         QAction *item = new QAction(colors);
+        QFileInfo fileInfo = itr.next().value();
+        QAction *item = new QAction(colors);
         item->setCheckable(true);
         item->setText(fileInfo.baseName());
         item->setData(fileInfo.absoluteFilePath());
@@ -110,13 +155,15 @@ void ThemeLoader::findColorStyles(QMenu *colors, const QString& configSelectedSt
     if (selectedStyle.length() < 1) {
         selectedStyle = DEFAULT_CSS;
     }
+    //by name, the selected file may since have been overridden
+    QString selectedName = QFileInfo(selectedStyle).baseName();
     QAction *selectedAction = nullptr;
 
     QListIterator<QAction*> itrActions(color_group->actions());
     while (itrActions.hasNext()) {
         QAction *item = itrActions.next();
 
-        if (item->data().toString() == selectedStyle) {
+        if (item->text() == selectedName) {
             item->setChecked(true);
             selectedAction = item;
         }
@@ -128,231 +175,274 @@ void ThemeLoader::findColorStyles(QMenu *colors, const QString& configSelectedSt
     }
 }
 
-int ThemeLoader::loadLayout(const QString& themeName, const QString& path)
+int ThemeLoader::loadLayout(const QString& themeName)
 {
-    QFile themeFile;
-    QDomDocument doc;
-
-    themeFile.setFileName(QString(path + QLatin1String("%1.xml")).arg(themeName));
+    ThemeLayout layout;
 
-    if (!themeFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QMessageBox::information(nullptr, QLatin1String("Error"), QLatin1String("Unable to open theme xml file: %1").arg(themeFile.fileName()));
-        return -1;
+    //only a theme parsed from xml has a file to reload; a compiled theme
+    //or a failed load must not diff the old file into the new layout
+    if (!themeFile.isEmpty() && watcher->files().contains(themeFile)) {
+        watcher->removePath(themeFile);
     }
-    if (!doc.setContent(&themeFile)) {
-        QMessageBox::information(nullptr, QLatin1String("Error"), QLatin1String("Unable to parse theme xml file: %1").arg(themeFile.fileName()));
-        return -2;
+    themeFile.clear();
+    reloadThemeFile = false;
+
+    //a theme in the user's data directory ($XDG_DATA_HOME/kvkbd/themes)
+    //overrides the bundled one of the same name, site wide copies do not;
+    //bundled themes come pre-resolved, everything else is parsed
+    QByteArray compiled;
+    if (userThemeFilePath(themeName).isEmpty()) {
+        compiled = compiledTheme(themeName);
     }
-    themeFile.close();
-
-    QDomElement docElem = doc.documentElement();
-
-    QDomNodeList wList = docElem.elementsByTagName(QLatin1String("buttonWidth"));
-    QDomNode wNode = wList.at(0);
+    if (!compiled.isEmpty()) {
+        QBuffer buffer(&compiled);
+        buffer.open(QIODevice::ReadOnly);
+        if (!layout.read(&buffer)) {
+            qWarning() << "Unable to read compiled theme:" << themeName;
+            return -2;
+        }
+    }
+    else {
+        QFile themeFile(themeFilePath(themeName));
 
-    //read default button width
-    defaultWidth = wNode.attributes().namedItem(QLatin1String("width")).toAttr().value().toInt();
+        if (themeFile.fileName().isEmpty() || !themeFile.open(QIODevice::ReadOnly)) {
+            qWarning() << "Unable to open theme xml file for theme:" << themeName;
+            return -1;
+        }
+        QString error;
+        if (!layout.parseXml(&themeFile, &error)) {
+            qWarning().noquote() << "Unable to parse theme xml file" << themeFile.fileName() << error;
+            return -2;
+        }
+        themeFile.close();
 
-    QDomNodeList nList = (wNode.toElement()).elementsByTagName(QLatin1String("item"));
-    for (int a=0; a<nList.count(); a++) {
-        QDomNode node = nList.at(a);
-        int width = node.attributes().namedItem(QLatin1String("width")).toAttr().value().toInt();
-        QString hintName = node.attributes().namedItem(QLatin1String("name")).toAttr().value();
-        widthMap.insert(hintName, width);
+        this->themeFile = themeFile.fileName();
+        watchFile(this->themeFile);
     }
 
-    wList = docElem.elementsByTagName(QLatin1String("buttonHeight"));
-    wNode = wList.at(0);
-    nList = (wNode.toElement()).elementsByTagName(QLatin1String("item"));
-    for (int a=0; a<nList.count(); a++) {
-        QDomNode node = nList.at(a);
-        int height = node.attributes().namedItem(QLatin1String("height")).toAttr().value().toInt();
-        QString hintName = node.attributes().namedItem(QLatin1String("name")).toAttr().value();
-        heightMap.insert(hintName, height);
-    }
+    //parts become widgets only once they are shown
+    themeLayout = layout;
+    return 0;
+}
+const ThemeLayout& ThemeLoader::layout() const
+{
+    return themeLayout;
+}
+MainWidget *ThemeLoader::createPart(const QString& partName)
+{
+    const ThemePart *themePart = themeLayout.part(partName);
+    if (!themePart) return nullptr;
 
-    wList = docElem.elementsByTagName(QLatin1String("spacingHints"));
-    wNode = wList.at(0);
-    nList = (wNode.toElement()).elementsByTagName(QLatin1String("item"));
-    for (int a=0; a<nList.count(); a++) {
-        QDomNode node = nList.at(a);
-        int width = node.attributes().namedItem(QLatin1String("width")).toAttr().value().toInt();
-        QString hintName = node.attributes().namedItem(QLatin1String("name")).toAttr().value();
-        spacingMap.insert(hintName, width);
+    MainWidget *part = new MainWidget((QWidget*)parent());
+    part->setProperty("part", themePart->name);
+    createdParts.insert(themePart->name, part);
+    loadKeys(part, *themePart);
+    return part;
+}
+void ThemeLoader::loadKeys(MainWidget *vPart, const ThemePart& themePart)
+{
+    QVectorIterator<ThemeKey> itr(themePart.keys);
+    while (itr.hasNext()) {
+        KeyDescriptor key = createKey(vPart, itr.next());
+
+        vPart->addKey(key);
+        Q_EMIT buttonLoaded(key.button, key);
     }
 
-    wList = docElem.elementsByTagName(QLatin1String("part"));
-    wNode = wList.at(0);
+    vPart->setBaseSize(themePart.baseSize.width(), themePart.baseSize.height());
 
-    //insert main part to widget
-    QString partName = wNode.attributes().namedItem(QLatin1String("name")).toAttr().value();
+    Q_EMIT partLoaded(vPart, themePart.rows, themePart.columns);
+}
+KeyDescriptor ThemeLoader::createKey(MainWidget *vPart, const ThemeKey& themeKey)
+{
+    KeyDescriptor key;
+    key.button = new VButton(vPart);
 
-    MainWidget *part = new MainWidget((QWidget*)parent());
-    part->setProperty("part", QLatin1String("main"));
+    //these decide how the button is connected, a reused one keeps them
+    key.modifier = themeKey.modifier;
+    key.action = KeyDescriptor::actionFromName(themeKey.action);
+    key.part = themeKey.part.length()>0 ? themeKey.part : QString(QLatin1String("extension"));
 
-    loadKeys(part, wNode);
+    applyKey(key, themeKey, nullptr);
+    return key;
+}
+void ThemeLoader::applyKey(KeyDescriptor& key, const ThemeKey& themeKey, const ThemeKey *previous)
+{
+    VButton *btn = key.button;
 
-    wList = wNode.childNodes();
+    if (!previous || previous->name != themeKey.name) {
+        btn->setObjectName(themeKey.name);
+    }
 
-    for (int a=0; a<wList.size(); a++) {
+    key.label = themeKey.label;
+    if (key.label.length()>0 && (!previous || previous->label != themeKey.label)) {
+        btn->setText(key.label);
+    }
 
-        QDomNode wNode = wList.at(a);
-        if (wNode.toElement().tagName() == QLatin1String("extension")) {
-            MainWidget *widget1 = new MainWidget((QWidget*)parent());
-            widget1->setProperty("part", QLatin1String("extension"));
-            loadKeys(widget1, wNode);
-            break;
+    key.groupLabel = themeKey.groupLabel;
+    key.groupToggle = GroupState::group(themeKey.groupToggle);
+    key.groupName = GroupState::group(themeKey.groupName);
+
+    //stay properties, the color styles select on them
+    if (!previous || previous->colorGroup != themeKey.colorGroup || previous->action != themeKey.action) {
+        btn->setProperty("colorGroup", themeKey.colorGroup.length()>0 ? themeKey.colorGroup : QString(QLatin1String("normal")));
+        btn->setProperty("action", KeyDescriptor::canonicalActionName(themeKey.action));
+        if (previous) {
+            btn->style()->unpolish(btn);
+            btn->style()->polish(btn);
         }
     }
-    return 0;
-}
-bool ThemeLoader::applyProperty(VButton *btn, const QString& attributeName, QDomNamedNodeMap *attributes, QVariant defaultValue)
-{
-    bool ret = false;
 
-    QString attributeValue = attributes->namedItem(attributeName).toAttr().value();
-    if (attributeValue.length()>0) {
-        btn->setProperty(qPrintable(attributeName), attributeValue);
-        ret = true;
+    if (!previous || previous->tooltip != themeKey.tooltip) {
+        btn->setToolTip(themeKey.tooltip);
     }
-    else {
-        if (defaultValue.toString().length()>0) {
-            btn->setProperty(qPrintable(attributeName), defaultValue);
-            ret = true;
-        }
+
+    key.keyCode = themeKey.keyCode;
+    btn->setKeyCode(themeKey.keyCode);
+
+    if (!previous || previous->checkable != themeKey.checkable) {
+        btn->setCheckable(themeKey.modifier || themeKey.checkable);
+        btn->setChecked(false);
+    }
+
+    btn->setAccelerated(themeKey.accelerate);
+
+    if (!previous || previous->rect != themeKey.rect) {
+        btn->setGeometry(themeKey.rect);
+        btn->storeSize();
     }
-    return ret;
 }
-void ThemeLoader::loadKeys(MainWidget *vPart, const QDomNode& wNode)
+//keys are matched by name, or by code and label for unnamed ones
+static QString keyIdentity(const ThemeKey& key, QHash<QString, int>& seen)
 {
-    int max_sx = 0;
-    int max_sy = 0;
+    QString identity = key.name;
+    if (identity.isEmpty()) {
+        identity = QString::fromLatin1("%1:%2").arg(key.keyCode).arg(key.label);
+    }
+    int occurrence = seen.value(identity);
+    seen.insert(identity, occurrence+1);
 
-    int sx = 0;
-    int sy = 0;
-    int rowMarginLeft = 0;
-    int rowSpacingY = 0;
-    int rowSpacingX = 0;
+    return identity + QLatin1Char('#') + QString::number(occurrence);
+}
+void ThemeLoader::updatePart(MainWidget *vPart, const ThemePart& previous, const ThemePart& themePart)
+{
+    QVector<KeyDescriptor> oldKeys = vPart->keyDescriptors();
 
-    int total_cols = 0;
-    int total_rows = 0;
+    QHash<QString, int> seen;
+    QHash<QString, int> oldIndex;
+    for (int a=0; a<previous.keys.count() && a<oldKeys.count(); a++) {
+        oldIndex.insert(keyIdentity(previous.keys.at(a), seen), a);
+    }
 
-    QDomNodeList nList = wNode.childNodes();
+    QVector<bool> reused(oldKeys.count(), false);
+    QVector<KeyDescriptor> newKeys;
+    QList<int> created;
 
-    for (int a=0; a<nList.size(); a++) {
+    seen.clear();
+    QVectorIterator<ThemeKey> itr(themePart.keys);
+    while (itr.hasNext()) {
+        const ThemeKey& themeKey = itr.next();
+        int index = oldIndex.value(keyIdentity(themeKey, seen), -1);
+
+        //keys whose connections differ are made again
+        if (index >= 0) {
+            const ThemeKey& oldKey = previous.keys.at(index);
+            if (oldKey.modifier != themeKey.modifier || oldKey.action != themeKey.action || oldKey.part != themeKey.part) {
+                index = -1;
+            }
+        }
 
-        QDomNode wNode = nList.at(a);
-        if (wNode.toElement().tagName() != QLatin1String("row")) continue;
+        if (index >= 0) {
+            KeyDescriptor key = oldKeys.at(index);
+            applyKey(key, themeKey, &previous.keys.at(index));
+            reused[index] = true;
+            newKeys.append(key);
+        }
+        else {
+            created << newKeys.count();
+            newKeys.append(createKey(vPart, themeKey));
+        }
+    }
 
-        total_rows++;
+    for (int a=0; a<oldKeys.count(); a++) {
+        if (reused.at(a)) continue;
+        Q_EMIT buttonRemoved(oldKeys.at(a).button, oldKeys.at(a));
+        oldKeys.at(a).button->deleteLater();
+    }
 
-        int rowHeight = defaultHeight;
+    vPart->clearKeys();
+    for (int a=0; a<newKeys.count(); a++) {
+        vPart->addKey(newKeys.at(a));
+    }
 
-        int row_buttons = 0;
+    QListIterator<int> citr(created);
+    while (citr.hasNext()) {
+        const KeyDescriptor& key = newKeys.at(citr.next());
+        Q_EMIT buttonLoaded(key.button, key);
+    }
 
-        QDomNodeList key_list = wNode.childNodes();
+    vPart->setBaseSize(themePart.baseSize.width(), themePart.baseSize.height());
+    vPart->relayout();
+}
+void ThemeLoader::watchFile(const QString& fileName)
+{
+    //resources never change
+    if (fileName.isEmpty() || fileName.startsWith(QLatin1Char(':'))) return;
 
-        QString rowHeightHint = wNode.attributes().namedItem(QLatin1String("height")).toAttr().value();
-        if (heightMap.contains(rowHeightHint)) {
-            rowHeight = heightMap.value(rowHeightHint);
-        }
+    if (!watcher->files().contains(fileName)) {
+        watcher->addPath(fileName);
+    }
+}
+void ThemeLoader::fileChanged(const QString& fileName)
+{
+    //editors that save by replacing the file drop it from the watcher
+    if (QFileInfo::exists(fileName)) {
+        watcher->addPath(fileName);
+    }
 
-        for (int b=0; b<key_list.count(); b++) {
-            QDomNode node = key_list.at(b);
-            QDomNamedNodeMap attributes = node.attributes();
-
-            if (node.toElement().tagName()== QLatin1String("key")) {
-
-                VButton *btn = new VButton(vPart);
-                row_buttons++;
-
-                //width
-                int buttonWidth = defaultWidth;
-                int buttonHeight = defaultHeight;
-
-                QString widthHint = attributes.namedItem(QLatin1String("width")).toAttr().value();
-                if (widthMap.contains(widthHint)) {
-                    buttonWidth = widthMap.value(widthHint);
-                }
-
-                QString heightHint = attributes.namedItem(QLatin1String("height")).toAttr().value();
-                if (heightMap.contains(heightHint)) {
-                    buttonHeight = heightMap.value(heightHint);
-                }
-
-                //name
-                QString button_name = attributes.namedItem(QLatin1String("name")).toAttr().value();
-                if (button_name.length()>0) {
-                    btn->setObjectName(button_name);
-                }
-
-                if (applyProperty(btn, QLatin1String("label"), &attributes)) {
-                    btn->setText(btn->property("label").toString());
-                }
-
-                applyProperty(btn, QLatin1String("group_label"), &attributes);
-                applyProperty(btn, QLatin1String("group_toggle"), &attributes);
-                applyProperty(btn, QLatin1String("group_name"), &attributes);
-                applyProperty(btn, QLatin1String("colorGroup"), &attributes, QLatin1String("normal"));
-                applyProperty(btn, QLatin1String("tooltip"), &attributes);
-
-                QString modifier = attributes.namedItem(QLatin1String("modifier")).toAttr().value();
-                if (modifier.toInt()>0) {
-                    btn->setProperty("modifier", true);
-                    btn->setCheckable(true);
-                }
-
-                unsigned int key_code = attributes.namedItem(QLatin1String("code")).toAttr().value().toInt();
-                if (key_code>0) {
-                    btn->setKeyCode(key_code);
-                }
-
-                if (applyProperty(btn, QLatin1String("action"), &attributes)) {
-                    btn->setProperty("action", btn->property("action").toString());
-                }
-
-                int is_checkable = attributes.namedItem(QLatin1String("checkable")).toAttr().value().toInt();
-                if (is_checkable>0) {
-                    btn->setCheckable(true);
-                    btn->setChecked(false);
-                }
-
-                btn->move(sx,sy);
-                btn->resize(buttonWidth, buttonHeight);
-                btn->storeSize();
-
-                sx += buttonWidth+rowSpacingX;
-
-                Q_EMIT buttonLoaded(btn);
-            }
-            else if (node.toElement().tagName()==QLatin1String("spacing")) {
-
-                QString widthHint = attributes.namedItem(QLatin1String("width")).toAttr().value();
-                QString heightHint = attributes.namedItem(QLatin1String("height")).toAttr().value();
-
-                if (spacingMap.contains(widthHint)) {
-                    int spacingWidth = spacingMap.value(widthHint);
-                    sx += spacingWidth;
-                }
-                if (heightMap.contains(heightHint)) {
-                    int spacingHeight = heightMap.value(heightHint);
-                    if (spacingHeight>rowHeight) rowHeight = spacingHeight;
-                }
-            }
-        }//row
+    if (fileName == themeFile) reloadThemeFile = true;
+    if (fileName == colorFile) reloadColorFile = true;
 
-        if (sx>max_sx) max_sx = sx;
+    //one reload for the burst of changes a save produces
+    reloadTimer->start();
+}
+void ThemeLoader::reloadFiles()
+{
+    if (reloadColorFile) {
+        reloadColorFile = false;
+        loadColorFile(colorFile);
+    }
 
-        sy+=(rowHeight+rowSpacingY);
-        sx=0+rowMarginLeft;
+    if (!reloadThemeFile) return;
+    reloadThemeFile = false;
 
-        if (row_buttons>total_cols) total_cols=row_buttons;
+    QFile file(themeFile);
+    if (!file.open(QIODevice::ReadOnly)) return;
 
+    ThemeLayout layout;
+    QString error;
+    if (!layout.parseXml(&file, &error)) {
+        qWarning().noquote() << "Unable to parse theme xml file" << themeFile << error;
+        return;
     }
-    if (sy>max_sy) max_sy = sy;
 
-    vPart->setBaseSize(max_sx, max_sy);
+    ThemeLayout previous = themeLayout;
+    themeLayout = layout;
 
-    Q_EMIT partLoaded(vPart, total_rows, total_cols);
+    QMutableMapIterator<QString, QPointer<MainWidget> > itr(createdParts);
+    while (itr.hasNext()) {
+        itr.next();
+
+        const ThemePart *oldPart = previous.part(itr.key());
+        const ThemePart *newPart = themeLayout.part(itr.key());
+
+        if (!itr.value()) {
+            itr.remove();
+        }
+        else if (oldPart && newPart) {
+            updatePart(itr.value(), *oldPart, *newPart);
+        }
+    }
 
+    Q_EMIT themeReloaded();
 }
@@ -21,14 +21,15 @@
 #ifndef THEMELOADER_H
 #define THEMELOADER_H
 
-#include <QObject>
-#include <QDomNode>
-#include <QDomNamedNodeMap>
-#include <QVariant>
+#include <QFileSystemWatcher>
 #include <QMap>
+#include <QObject>
 #include <QMenu>
+#include <QPointer>
+#include <QTimer>
 
 #include "mainwidget.h"
+#include "themelayout.h"
 #include "vbutton.h"
 
 class ThemeLoader : public QObject
@@ -41,23 +42,45 @@ public:
 
     void loadTheme(QString& themeName);
     void loadColorFile(const QString& fileName);
-    int loadLayout(const QString& themeName, const QString& path);
+    int loadLayout(const QString& themeName);
+    const ThemeLayout& layout() const;
+    MainWidget *createPart(const QString& partName);
+    //patches a live part from one version of its theme to the next
+    void updatePart(MainWidget *vPart, const ThemePart& previous, const ThemePart& themePart);
+    static QString themeFilePath(const QString& themeName);
+    //only themes in the user's data directory, empty when there is none
+    static QString userThemeFilePath(const QString& themeName);
     void findColorStyles(QMenu *parent, const QString& selectedStyle);
 
 protected:
-    void loadKeys(MainWidget *vPart, const QDomNode& wNode);
-    bool applyProperty(VButton *btn, const QString& attributeName, QDomNamedNodeMap *attributes, QVariant defaultValue = QString{});
+    void loadKeys(MainWidget *vPart, const ThemePart& themePart);
+    KeyDescriptor createKey(MainWidget *vPart, const ThemeKey& themeKey);
+    void applyKey(KeyDescriptor& key, const ThemeKey& themeKey, const ThemeKey *previous);
+    void watchFile(const QString& fileName);
 
-    QMap<QString, int> widthMap;
-    QMap<QString, int> heightMap;
-    QMap<QString, int> spacingMap;
+    ThemeLayout themeLayout;
+    QMap<QString, QPointer<MainWidget> > createdParts;
+
+    //theme and color files reloaded when edited
+    QFileSystemWatcher *watcher;
+    QTimer *reloadTimer;
+    QString themeFile;
+    QString colorFile;
+    bool reloadThemeFile = false;
+    bool reloadColorFile = false;
 
 public Q_SLOTS:
     void loadColorStyle();
 
+protected Q_SLOTS:
+    void fileChanged(const QString& fileName);
+    void reloadFiles();
+
 Q_SIGNALS:
     void partLoaded(MainWidget *vPart, int total_rows, int total_cols);
-    void buttonLoaded(VButton *btn);
+    void buttonLoaded(VButton *btn, const KeyDescriptor& key);
+    void buttonRemoved(VButton *btn, const KeyDescriptor& key);
+    void themeReloaded();
     void colorStyleChanged();
 };
 
@@ -1,10 +1,25 @@
 #include "vbutton.h"
+#include "latencystats.h"
 
 #define TIMER_INTERVAL_SHORT 40
 #define TIMER_INTERVAL_LONG  200
+#define TIMER_INTERVAL_MIN   10
 
 int VButton::RepeatShortDelay = TIMER_INTERVAL_SHORT;
 int VButton::RepeatLongDelay = TIMER_INTERVAL_LONG;
+int VButton::RepeatMinDelay = TIMER_INTERVAL_MIN;
+bool VButton::ServerRepeat = false;
+bool VButton::RepeatAcceleration = false;
+
+void VButton::setServerRepeat(bool mode)
+{
+    ServerRepeat = mode;
+}
+
+void VButton::setRepeatAcceleration(bool mode)
+{
+    RepeatAcceleration = mode;
+}
 
 
 VButton::VButton(QWidget *parent) :
@@ -17,6 +32,11 @@ VButton::VButton(QWidget *parent) :
     rightClicked = false;
     mTextIndex = 0;
     isCaps = false;
+    isShift = false;
+    isLevelThree = false;
+    isAccelerated = false;
+    isHeld = false;
+    tapTimestamp = 0;
 
     keyTimer = new QTimer(this);
 
@@ -43,9 +63,28 @@ unsigned int VButton::getKeyCode()
     return this->keyCode;
 }
 
+void VButton::setAccelerated(bool mode)
+{
+    isAccelerated = mode;
+}
+
 void VButton::setButtonText(const ButtonText& text)
 {
     this->mButtonText = text;
+    this->mTextIndex = levelIndex();
+
+    //both cased forms of every level, so shift and caps only pick one
+    for (int level=0; level<ButtonText::LevelCount; level++) {
+        QString levelText;
+        if (text.levels[level]) {
+            levelText = QString::fromUcs4(&text.levels[level], 1);
+        }
+        if (levelText == QLatin1String("&")) {
+            levelText += QLatin1Char('&');
+        }
+        casedText[level][0] = levelText.toLower();
+        casedText[level][1] = levelText.toUpper();
+    }
 }
 
 ButtonText VButton::buttonText() const
@@ -65,67 +104,85 @@ int VButton::textIndex()
 
 void VButton::nextText()
 {
-    if (mButtonText.count()<1)return;
+    if (mButtonText.isEmpty())return;
 
     mTextIndex++;
-    int textCount = mButtonText.count()-1;
-    if (mTextIndex>textCount) mTextIndex=0;
+    if (mTextIndex>=ButtonText::LevelCount) mTextIndex=0;
 
     updateText();
 }
 
 void VButton::setCaps(bool mode)
 {
-    if (mButtonText.count()<1)return;
+    if (mButtonText.isEmpty())return;
 
     isCaps = mode;
 }
 void VButton::setShift(bool mode)
 {
-    if (mButtonText.count()<1)return;
-    if (mode) {
-        this->mTextIndex = 1;
+    isShift = mode;
+    this->mTextIndex = levelIndex();
+}
+void VButton::setLevelThree(bool mode)
+{
+    isLevelThree = mode;
+    this->mTextIndex = levelIndex();
+}
+int VButton::levelIndex() const
+{
+    //shift selects level 2, AltGr levels 3 and 4 when the key has them
+    int index = isShift ? 1 : 0;
+    if (isLevelThree && mButtonText.levels[index + 2]) {
+        index += 2;
     }
-    else {
-        this->mTextIndex = 0;
+    if (!mButtonText.levels[index]) {
+        index = 0;
     }
-    isShift = mode;
+    return index;
 }
 void VButton::updateText()
 {
-    if (mButtonText.count()<1)return;
-
-    QString text = mButtonText.at(this->mTextIndex);
-    if (text == QLatin1Char('&')) {
-        text += QLatin1Char('&');
-    }
+    if (mButtonText.isEmpty())return;
 
     bool doCaps = isCaps ;
     if (isShift) doCaps = !doCaps;
 
-    if (doCaps) {
-        text = text.toUpper();
-    }
-    else {
-        text = text.toLower();
-    }
-    this->setText(text);
+    this->setText(casedText[this->mTextIndex][doCaps ? 1 : 0]);
 }
 
 void VButton::sendKey()
 {
+    LatencyTap tap(tapTimestamp);
     Q_EMIT keyClick(this->keyCode);
 }
 
 void VButton::mousePressEvent(QMouseEvent *e)
 {
+    LatencyTimer timer(LatencyStats::Press);
+    qint64 timestamp = LatencyStats::now();
+
     QPushButton::mousePressEvent(e);
+    pressKey(e->button(), timestamp);
+}
+
+void VButton::pressKey(Qt::MouseButton button, qint64 timestamp)
+{
+    tapTimestamp = timestamp;
+
     rightClicked = false;
-    if (e->button() == Qt::RightButton) {
+    if (button == Qt::RightButton) {
         rightClicked = true;
     }
 
     if (this->keyCode>0) {
+        //accelerated repeat needs its own timing, so those keys stay client side
+        if (!isCheckable() && ServerRepeat && !(isAccelerated && RepeatAcceleration)) {
+            isHeld = true;
+            LatencyTap tap(tapTimestamp);
+            Q_EMIT keyDown(this->keyCode);
+            return;
+        }
+
         sendKey();
 
         if (!isCheckable()) {
@@ -139,18 +196,50 @@ void VButton::mousePressEvent(QMouseEvent *e)
 
 void VButton::mouseReleaseEvent(QMouseEvent *e)
 {
-    if (keyTimer->isActive())keyTimer->stop();
+    releaseKey(LatencyStats::now());
     QPushButton::mouseReleaseEvent(e);
 }
 
+void VButton::releaseKey(qint64 timestamp)
+{
+    tapTimestamp = timestamp;
+
+    if (keyTimer->isActive())keyTimer->stop();
+    releaseHeldKey();
+}
+
+void VButton::hideEvent(QHideEvent *e)
+{
+    //never leave a key down in the server when the button goes away
+    tapTimestamp = 0;
+    if (keyTimer->isActive())keyTimer->stop();
+    releaseHeldKey();
+    QPushButton::hideEvent(e);
+}
+
+void VButton::releaseHeldKey()
+{
+    if (!isHeld) return;
+
+    isHeld = false;
+    LatencyTap tap(tapTimestamp);
+    Q_EMIT keyUp(this->keyCode);
+}
+
 void VButton::repeatKey()
 {
     //if the user is still pressing the button after 200 ms, we assume
     //he wants the key to be quickly repeated and we decrease the interval
     if (keyTimer->interval() == VButton::RepeatLongDelay) {
-        //TODO: make this configurable?
         keyTimer->setInterval(VButton::RepeatShortDelay);
     }
+    else if (isAccelerated && RepeatAcceleration) {
+        //every repeat shortens the next interval by 15% down to the minimum
+        int interval = keyTimer->interval() * 85 / 100;
+        keyTimer->setInterval(qMax(VButton::RepeatMinDelay, interval));
+    }
 
+    //each repeat is a tap of its own
+    tapTimestamp = LatencyStats::now();
     sendKey();
 }
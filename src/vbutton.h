@@ -26,6 +26,13 @@ public:
     unsigned int getKeyCode();
     void setKeyCode(unsigned int keyCode);
 
+    //repeat speeds up the longer the key is held, when enabled globally
+    void setAccelerated(bool mode);
+
+    //held keys are sent as a press and a release and repeated by the server
+    static void setServerRepeat(bool mode);
+    static void setRepeatAcceleration(bool mode);
+
     void setButtonText(const ButtonText& text);
     ButtonText buttonText() const;
 
@@ -35,9 +42,18 @@ public:
     void nextText();
     void setCaps(bool mode);
     void setShift(bool mode);
+    void setLevelThree(bool mode);
+
+    //key handling of a press and release, for views that paint the
+    //button themselves instead of showing it; timestamp is the
+    //LatencyStats::now() of the mouse event, 0 when there is none
+    void pressKey(Qt::MouseButton button, qint64 timestamp = 0);
+    void releaseKey(qint64 timestamp = 0);
 
 Q_SIGNALS:
     void keyClick(unsigned int);
+    void keyDown(unsigned int);
+    void keyUp(unsigned int);
     void buttonAction(const QString& action);
 
 public Q_SLOTS:
@@ -51,17 +67,32 @@ protected:
     QTimer *keyTimer;
 
     ButtonText mButtonText;
+    //lower and upper case text of each level
+    QString casedText[ButtonText::LevelCount][2];
     int mTextIndex;
 
     bool isCaps;
     bool isShift;
+    bool isLevelThree;
+    bool isAccelerated;
+    //keyDown sent, keyUp pending
+    bool isHeld;
+    //LatencyStats::now() of the press, release or repeat being sent
+    qint64 tapTimestamp;
+
+    int levelIndex() const;
+    void releaseHeldKey();
 
     static int RepeatShortDelay;
     static int RepeatLongDelay;
+    static int RepeatMinDelay;
+    static bool ServerRepeat;
+    static bool RepeatAcceleration;
 
 protected Q_SLOTS:
     void mousePressEvent(QMouseEvent *e) override;
     void mouseReleaseEvent(QMouseEvent *e) override;
+    void hideEvent(QHideEvent *e) override;
     void repeatKey();
 };
 
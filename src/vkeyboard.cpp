@@ -20,10 +20,186 @@
 
 #include "vkeyboard.h"
 
-VKeyboard::VKeyboard(QObject *parent) : QObject(parent)
+#include <QDBusAbstractInterface>
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+
+#include "vbutton.h"
+extern QList<VButton *> modKeys;
+
+// Plain proxy for the keyboard daemon. Unlike QDBusInterface it does not
+// introspect the remote object, which would be a blocking call.
+class KeyboardLayoutsInterface : public QDBusAbstractInterface
 {
+public:
+    KeyboardLayoutsInterface(QObject *parent) :
+        QDBusAbstractInterface(QLatin1String("org.kde.keyboard"), QLatin1String("/Layouts"), "org.kde.KeyboardLayouts", QDBusConnection::sessionBus(), parent)
+    {
+    }
+};
+
+VKeyboard::VKeyboard(QObject *parent) : VKeyboard(parent, true)
+{
+}
+
+VKeyboard::VKeyboard(QObject *parent, bool hostLayouts) : QObject(parent), layout_index(0), layoutsProxy(nullptr)
+{
+    if (!hostLayouts) return;
+
+    layoutsProxy = new KeyboardLayoutsInterface(this);
+
+    QString service = QLatin1String("");
+    QString path = QLatin1String("/Layouts");
+    QString interface = QLatin1String("org.kde.KeyboardLayouts");
+
+    QDBusConnection session = QDBusConnection::sessionBus();
+
+    session.connect(service, path, interface, QLatin1String("currentLayoutChanged"), this, SLOT(layoutChanged()));
+    session.connect(service, path, interface, QLatin1String("layoutListChanged"), this, SLOT(constructLayouts()));
+
+    constructLayouts();
 }
 
 VKeyboard::~VKeyboard()
 {
 }
+
+int GroupState::group(const QString& name)
+{
+#define GROUP_NAME(id, text) text,
+    static const char *group_names[GroupCount] = { LOCK_GROUPS(GROUP_NAME) };
+#undef GROUP_NAME
+
+    for (int group=0; group<GroupCount; group++) {
+        if (name == QLatin1String(group_names[group])) return group;
+    }
+    return -1;
+}
+
+QDBusArgument& operator<<(QDBusArgument& argument, const KeyStroke& stroke)
+{
+    argument.beginStructure();
+    argument << stroke.keyCode << stroke.modifiers;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument& operator>>(const QDBusArgument& argument, KeyStroke& stroke)
+{
+    argument.beginStructure();
+    argument >> stroke.keyCode >> stroke.modifiers;
+    argument.endStructure();
+    return argument;
+}
+
+bool VKeyboard::typeText(const QString&)
+{
+    return false;
+}
+
+void VKeyboard::pressKeys(const KeyStrokeList& keys)
+{
+    //modifier masks mean nothing to backends without batches
+    QListIterator<KeyStroke> itr(keys);
+    while (itr.hasNext()) {
+        processKeyPress(itr.next().keyCode);
+    }
+}
+
+void VKeyboard::processKeyDown(unsigned int)
+{
+}
+
+void VKeyboard::processKeyUp(unsigned int keyCode)
+{
+    processKeyPress(keyCode);
+}
+
+void VKeyboard::setModifierLatching(bool)
+{
+}
+
+void VKeyboard::modifiersChanged(bool)
+{
+}
+
+QList<unsigned int> VKeyboard::checkedModifiers() const
+{
+    QList<unsigned int> codes;
+
+    QListIterator<VButton *> itr(modKeys);
+    while (itr.hasNext()) {
+        VButton *mod = itr.next();
+        if (mod->isChecked()) {
+            codes << mod->getKeyCode();
+        }
+    }
+    return codes;
+}
+
+void VKeyboard::constructLayouts()
+{
+    if (!layoutsProxy) return;
+
+    //replies arrive in call order, so the list is in place before any
+    //current layout requested after this
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(layoutsProxy->asyncCall(QLatin1String("getLayoutsList")), this);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(layoutListReceived(QDBusPendingCallWatcher*)));
+}
+
+void VKeyboard::layoutChanged()
+{
+    if (!layoutsProxy) return;
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(layoutsProxy->asyncCall(QLatin1String("getCurrentLayout")), this);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(currentLayoutReceived(QDBusPendingCallWatcher*)));
+}
+
+void VKeyboard::layoutListReceived(QDBusPendingCallWatcher *watcher)
+{
+    QDBusPendingReply<QStringList> reply = *watcher;
+    watcher->deleteLater();
+
+    if (reply.isError()) return;
+
+    layouts = reply.value();
+
+    layoutListReady();
+
+    //the group of the current layout may have moved
+    if (!current_layout.isEmpty()) {
+        layout_index = qMax(0, layouts.indexOf(current_layout));
+        currentLayoutReady();
+        Q_EMIT layoutUpdated(layout_index, current_layout);
+    }
+}
+
+void VKeyboard::currentLayoutReceived(QDBusPendingCallWatcher *watcher)
+{
+    QDBusPendingReply<QString> reply = *watcher;
+    watcher->deleteLater();
+
+    if (reply.isError()) {
+        current_layout.clear();
+        layout_index = 0;
+        currentLayoutReady();
+        Q_EMIT layoutUpdated(0, QLatin1String("us"));
+        return;
+    }
+
+    current_layout = reply.value();
+    layout_index = qMax(0, layouts.indexOf(current_layout));
+
+    currentLayoutReady();
+    Q_EMIT layoutUpdated(layout_index, current_layout);
+}
+
+void VKeyboard::layoutListReady()
+{
+}
+
+void VKeyboard::currentLayoutReady()
+{
+}
@@ -22,16 +22,83 @@
 #define VKEYBOARD_H
 
 #include <QObject>
-#include <QMap>
-#include <QMapIterator>
 #include <QList>
-#include <QChar>
+#include <QStringList>
+#include <QMetaType>
 
-//caps state, numlock state
-typedef QMap<QString, bool> ModifierGroupStateMap;
-typedef QMapIterator<QString, bool> ModifierGroupStateMapIterator;
-//normal text, shift text
-typedef QList<QChar> ButtonText;
+class QDBusAbstractInterface;
+class QDBusArgument;
+class QDBusPendingCallWatcher;
+
+//lock groups with their theme names, a new group only needs an entry here
+#define LOCK_GROUPS(GROUP) \
+    GROUP(CapsLock, "capslock") \
+    GROUP(NumLock, "numlock")
+
+//lock groups as a bitset, with the bits that changed since the last update
+struct GroupState
+{
+#define GROUP_ENUM(id, text) id,
+    enum Group { LOCK_GROUPS(GROUP_ENUM) GroupCount };
+#undef GROUP_ENUM
+    enum { AllGroups = (1 << GroupCount) - 1 };
+
+    GroupState() : state(0), changed(0) {}
+
+    bool isSet(int group) const { return state & (1u << group); }
+    bool isChanged(int group) const { return changed & (1u << group); }
+    //marks the group changed when the value differs
+    void set(int group, bool on)
+    {
+        unsigned int bit = 1u << group;
+        if (((state & bit) != 0) != on) {
+            state ^= bit;
+            changed |= bit;
+        }
+    }
+
+    //theme group names, -1 for none
+    static int group(const QString& name);
+
+    unsigned int state;
+    unsigned int changed;
+};
+Q_DECLARE_METATYPE(GroupState)
+//character of each shift level (normal, shift, AltGr, AltGr+shift), 0 for none
+struct ButtonText
+{
+    enum { LevelCount = 4 };
+
+    ButtonText() { clear(); }
+
+    void clear()
+    {
+        for (int level=0; level<LevelCount; level++) levels[level] = 0;
+    }
+    bool isEmpty() const
+    {
+        for (int level=0; level<LevelCount; level++) {
+            if (levels[level]) return false;
+        }
+        return true;
+    }
+
+    char32_t levels[LevelCount];
+};
+
+//key code and X modifier mask of one key of a pressKeys batch
+struct KeyStroke
+{
+    unsigned int keyCode;
+    unsigned int modifiers;
+};
+typedef QList<KeyStroke> KeyStrokeList;
+
+Q_DECLARE_METATYPE(KeyStroke)
+Q_DECLARE_METATYPE(KeyStrokeList)
+
+QDBusArgument& operator<<(QDBusArgument& argument, const KeyStroke& stroke);
+const QDBusArgument& operator>>(const QDBusArgument& argument, KeyStroke& stroke);
 
 class VKeyboard : public QObject
 {
@@ -43,21 +110,62 @@ public:
 
     virtual void textForKeyCode(unsigned int keyCode, ButtonText& text)=0;
 
+    //batches sent with a single flush, ignoring the modifier buttons;
+    //typeText is false when some characters could not be typed
+    virtual bool typeText(const QString& text);
+    virtual void pressKeys(const KeyStrokeList& keys);
+
 public Q_SLOTS:
     virtual void processKeyPress(unsigned int)=0;
+    //held keys, repeated by the server while down; backends without
+    //separate press and release send a single click on key up
+    virtual void processKeyDown(unsigned int);
+    virtual void processKeyUp(unsigned int);
     virtual void queryModState()=0;
-    virtual void constructLayouts()=0;
-    virtual void layoutChanged()=0;
+    //apply checked modifiers as keyboard state instead of fake key presses,
+    //where the backend supports it; sticky modifiers are locked, others latched
+    virtual void setModifierLatching(bool mode);
+    virtual void modifiersChanged(bool sticky);
+    //ask the keyboard daemon, the answer arrives asynchronously; nothing
+    //for backends with layouts of their own
+    void constructLayouts();
+    void layoutChanged();
     virtual void start()=0;
 
 Q_SIGNALS:
     //key sent successfully
     void keyProcessComplete(unsigned int);
 
-    void groupStateChanged(const ModifierGroupStateMap& modifier_state);
+    //only emitted when a group changed, all are marked changed on start()
+    void groupStateChanged(const GroupState& groups);
 
     //layout index in list, layout caption
     void layoutUpdated(int, QString);
+
+protected Q_SLOTS:
+    void layoutListReceived(QDBusPendingCallWatcher *watcher);
+    void currentLayoutReceived(QDBusPendingCallWatcher *watcher);
+
+protected:
+    //hostLayouts false for backends with layouts of their own, which never
+    //talk to the keyboard daemon
+    VKeyboard(QObject *parent, bool hostLayouts);
+
+    //key codes of the currently checked modifier buttons
+    QList<unsigned int> checkedModifiers() const;
+
+    //called once layouts or layout_index hold the daemon's answer,
+    //before layoutUpdated is emitted
+    virtual void layoutListReady();
+    virtual void currentLayoutReady();
+
+    //layouts known to the keyboard daemon, index doubles as the XKB group
+    QStringList layouts;
+    int layout_index;
+    QString current_layout;
+
+    //null without host layouts
+    QDBusAbstractInterface *layoutsProxy;
 };
 
 #endif // VKEYBOARD_H
@@ -0,0 +1,395 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "waylandkeyboard.h"
+#include "latencystats.h"
+
+#include <QAbstractEventDispatcher>
+#include <QDebug>
+#include <QSocketNotifier>
+
+#include <wayland-client.h>
+#include "wayland-virtual-keyboard-unstable-v1-client-protocol.h"
+
+#include <xkbcommon/xkbcommon.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+//evdev key codes are X key codes minus 8
+#define EVDEV_OFFSET 8
+
+WaylandKeyboard::WaylandKeyboard(QObject *parent) : VKeyboard(parent),
+    display(nullptr), registry(nullptr), seat(nullptr), manager(nullptr), keyboard(nullptr), notifier(nullptr),
+    context(nullptr), keymap(nullptr), state(nullptr)
+{
+    static const wl_registry_listener registry_listener = {
+        WaylandKeyboard::registryGlobal,
+        WaylandKeyboard::registryGlobalRemove
+    };
+
+
+    display = wl_display_connect(nullptr);
+    if (!display) {
+        qWarning() << "Unable to connect to the Wayland compositor";
+        return;
+    }
+
+    registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, this);
+    wl_display_roundtrip(display);
+
+    if (!seat || !manager) {
+        qWarning() << "Compositor does not offer zwp_virtual_keyboard_manager_v1";
+        return;
+    }
+
+    keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(manager, seat);
+
+    context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!context || !compileKeymap() || !uploadKeymap()) {
+        return;
+    }
+
+    notifier = new QSocketNotifier(wl_display_get_fd(display), QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(dispatchEvents()));
+
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+    if (dispatcher) {
+        connect(dispatcher, SIGNAL(aboutToBlock()), this, SLOT(flush()));
+    }
+
+    clock.start();
+    wl_display_flush(display);
+}
+
+WaylandKeyboard::~WaylandKeyboard()
+{
+    if (keyboard) zwp_virtual_keyboard_v1_destroy(keyboard);
+    if (manager) zwp_virtual_keyboard_manager_v1_destroy(manager);
+    if (seat) wl_seat_destroy(seat);
+    if (registry) wl_registry_destroy(registry);
+
+    if (state) xkb_state_unref(state);
+    if (keymap) xkb_keymap_unref(keymap);
+    if (context) xkb_context_unref(context);
+
+    if (display) {
+        wl_display_flush(display);
+        wl_display_disconnect(display);
+    }
+}
+
+bool WaylandKeyboard::isValid() const
+{
+    return keyboard && state;
+}
+
+void WaylandKeyboard::registryGlobal(void *data, wl_registry *registry, uint32_t name, const char *interface, uint32_t)
+{
+    WaylandKeyboard *self = static_cast<WaylandKeyboard *>(data);
+
+    if (strcmp(interface, wl_seat_interface.name) == 0 && !self->seat) {
+        self->seat = static_cast<wl_seat *>(wl_registry_bind(registry, name, &wl_seat_interface, 1));
+    }
+    else if (strcmp(interface, zwp_virtual_keyboard_manager_v1_interface.name) == 0 && !self->manager) {
+        self->manager = static_cast<zwp_virtual_keyboard_manager_v1 *>(wl_registry_bind(registry, name, &zwp_virtual_keyboard_manager_v1_interface, 1));
+    }
+}
+
+void WaylandKeyboard::registryGlobalRemove(void *, wl_registry *, uint32_t)
+{
+}
+
+bool WaylandKeyboard::compileKeymap()
+{
+    QByteArray layoutNames = layouts.join(QLatin1Char(',')).toLatin1();
+
+    xkb_rule_names names;
+    memset(&names, 0, sizeof(names));
+    if (!layoutNames.isEmpty()) {
+        names.layout = layoutNames.constData();
+    }
+
+    xkb_keymap *newKeymap = xkb_keymap_new_from_names(context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!newKeymap) {
+        qWarning() << "Unable to compile keymap for layouts" << layouts;
+        return false;
+    }
+
+    if (state) xkb_state_unref(state);
+    if (keymap) xkb_keymap_unref(keymap);
+
+    keymap = newKeymap;
+    state = xkb_state_new(keymap);
+
+    xkb_keycode_t minKeyCode = xkb_keymap_min_keycode(keymap);
+    xkb_keycode_t maxKeyCode = xkb_keymap_max_keycode(keymap);
+    int groupCount = qBound(1, (int) xkb_keymap_num_layouts(keymap), (int) KeymapSnapshot::MaxGroups);
+
+    KeymapSnapshot snapshot;
+    snapshot.reset(minKeyCode, maxKeyCode, groupCount);
+
+    for (xkb_keycode_t keyCode=minKeyCode; keyCode<=maxKeyCode; keyCode++) {
+
+        int keyGroups = qMin((int) xkb_keymap_num_layouts_for_key(keymap, keyCode), (int) KeymapSnapshot::MaxGroups);
+
+        for (int group=0; group<keyGroups; group++) {
+            int levels = qMin((int) xkb_keymap_num_levels_for_key(keymap, keyCode, group), (int) KeymapSnapshot::LevelCount);
+            for (int level=0; level<levels; level++) {
+                const xkb_keysym_t *syms = nullptr;
+                if (xkb_keymap_key_get_syms_by_level(keymap, keyCode, group, level, &syms) > 0) {
+                    snapshot.keySym(keyCode, group, level) = syms[0];
+                }
+            }
+        }
+
+        for (int group=keyGroups; group<KeymapSnapshot::MaxGroups && keyGroups>0; group++) {
+            for (int level=0; level<KeymapSnapshot::LevelCount; level++) {
+                snapshot.keySym(keyCode, group, level) = snapshot.keySym(keyCode, group % keyGroups, level);
+            }
+        }
+    }
+
+    labelTables = KeyLabelTables::build(snapshot);
+    return true;
+}
+
+bool WaylandKeyboard::uploadKeymap()
+{
+    char *text = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    if (!text) return false;
+
+    size_t size = strlen(text) + 1;
+
+    int fd = memfd_create("kvkbd-keymap", MFD_CLOEXEC);
+    if (fd < 0) {
+        qWarning() << "Unable to create keymap file:" << strerror(errno);
+        free(text);
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t ret = write(fd, text + written, size - written);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            qWarning() << "Unable to write keymap file:" << strerror(errno);
+            close(fd);
+            free(text);
+            return false;
+        }
+        written += ret;
+    }
+
+    zwp_virtual_keyboard_v1_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size);
+
+    close(fd);
+    free(text);
+    return true;
+}
+
+void WaylandKeyboard::start()
+{
+    layoutChanged();
+    groupState.changed = GroupState::AllGroups;
+    Q_EMIT groupStateChanged(groupState);
+}
+
+void WaylandKeyboard::layoutListReady()
+{
+    //the uploaded keymap carries one group per configured layout
+    if (keyboard && compileKeymap() && uploadKeymap()) {
+        //layoutListReceived selects the group once the current layout is
+        //known, until then the new state stays on the first one
+        if (current_layout.isEmpty()) {
+            currentLayoutReady();
+        }
+    }
+}
+
+void WaylandKeyboard::currentLayoutReady()
+{
+    if (!isValid()) return;
+
+    xkb_state_update_mask(state,
+                          xkb_state_serialize_mods(state, XKB_STATE_MODS_DEPRESSED),
+                          xkb_state_serialize_mods(state, XKB_STATE_MODS_LATCHED),
+                          xkb_state_serialize_mods(state, XKB_STATE_MODS_LOCKED),
+                          0, 0, layout_index);
+    sendModifiers();
+    wl_display_flush(display);
+}
+
+void WaylandKeyboard::processKeyPress(unsigned int keyCode)
+{
+    LatencyTimer timer(LatencyStats::Process);
+
+    //the tap that sent the key, like the X11 KeyRequest::timestamp
+    qint64 pressTimestamp = LatencyStats::tapTimestamp();
+
+    if (isValid()) {
+        QList<unsigned int> modifiers = checkedModifiers();
+
+        qint64 start = LatencyStats::now();
+
+        QListIterator<unsigned int> itr(modifiers);
+        while (itr.hasNext()) {
+            sendKeyEvent(itr.next(), true);
+        }
+
+        sendKeyEvent(keyCode, true);
+        sendKeyEvent(keyCode, false);
+
+        itr.toBack();
+        while (itr.hasPrevious()) {
+            sendKeyEvent(itr.previous(), false);
+        }
+
+        wl_display_flush(display);
+
+        qint64 end = LatencyStats::now();
+        LatencyStats::record(LatencyStats::Inject, end - start);
+        LatencyStats::record(LatencyStats::TapToInject, end - pressTimestamp);
+
+        updateLockState();
+    }
+
+    Q_EMIT keyProcessComplete(keyCode);
+}
+
+void WaylandKeyboard::processKeyDown(unsigned int keyCode)
+{
+    LatencyTimer timer(LatencyStats::Process);
+
+    if (!isValid() || heldKeys.contains(keyCode)) return;
+
+    QList<unsigned int> modifiers = checkedModifiers();
+
+    QListIterator<unsigned int> itr(modifiers);
+    while (itr.hasNext()) {
+        sendKeyEvent(itr.next(), true);
+    }
+    sendKeyEvent(keyCode, true);
+
+    wl_display_flush(display);
+
+    //the focused client repeats the key from the seat's repeat info
+    heldKeys.insert(keyCode, modifiers);
+}
+
+void WaylandKeyboard::processKeyUp(unsigned int keyCode)
+{
+    LatencyTimer timer(LatencyStats::Process);
+
+    if (isValid() && heldKeys.contains(keyCode)) {
+        QList<unsigned int> modifiers = heldKeys.take(keyCode);
+
+        sendKeyEvent(keyCode, false);
+
+        QListIterator<unsigned int> itr(modifiers);
+        itr.toBack();
+        while (itr.hasPrevious()) {
+            sendKeyEvent(itr.previous(), false);
+        }
+
+        wl_display_flush(display);
+
+        updateLockState();
+    }
+
+    Q_EMIT keyProcessComplete(keyCode);
+}
+
+void WaylandKeyboard::sendKeyEvent(unsigned int keyCode, bool pressed)
+{
+    if (keyCode < EVDEV_OFFSET) return;
+
+    zwp_virtual_keyboard_v1_key(keyboard, (uint32_t) clock.elapsed(), keyCode - EVDEV_OFFSET,
+                                pressed ? WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED);
+
+    //the compositor is told about modifier changes explicitly
+    if (xkb_state_update_key(state, keyCode, pressed ? XKB_KEY_DOWN : XKB_KEY_UP) & XKB_STATE_MODS_EFFECTIVE) {
+        sendModifiers();
+    }
+}
+
+void WaylandKeyboard::sendModifiers()
+{
+    zwp_virtual_keyboard_v1_modifiers(keyboard,
+                                      xkb_state_serialize_mods(state, XKB_STATE_MODS_DEPRESSED),
+                                      xkb_state_serialize_mods(state, XKB_STATE_MODS_LATCHED),
+                                      xkb_state_serialize_mods(state, XKB_STATE_MODS_LOCKED),
+                                      xkb_state_serialize_layout(state, XKB_STATE_LAYOUT_EFFECTIVE));
+}
+
+void WaylandKeyboard::queryModState()
+{
+    updateLockState();
+}
+
+void WaylandKeyboard::updateLockState()
+{
+    if (!state) return;
+
+    //only the locks toggled through kvkbd are known to a Wayland client
+    bool curr_caps_state = xkb_state_mod_name_is_active(state, XKB_MOD_NAME_CAPS, XKB_STATE_MODS_LOCKED) > 0;
+    bool curr_num_state = xkb_state_mod_name_is_active(state, XKB_MOD_NAME_NUM, XKB_STATE_MODS_LOCKED) > 0;
+
+    groupState.changed = 0;
+    groupState.set(GroupState::CapsLock, curr_caps_state);
+    groupState.set(GroupState::NumLock, curr_num_state);
+
+    if (groupState.changed) {
+        Q_EMIT groupStateChanged(groupState);
+    }
+}
+
+void WaylandKeyboard::dispatchEvents()
+{
+    if (wl_display_prepare_read(display) == 0) {
+        wl_display_read_events(display);
+    }
+
+    if (wl_display_dispatch_pending(display) < 0) {
+        qWarning() << "Lost connection to the Wayland compositor";
+        notifier->setEnabled(false);
+        return;
+    }
+
+    wl_display_flush(display);
+}
+
+void WaylandKeyboard::flush()
+{
+    wl_display_flush(display);
+}
+
+void WaylandKeyboard::textForKeyCode(unsigned int keyCode, ButtonText& text)
+{
+    if (keyCode==0) {
+        text.clear();
+        return;
+    }
+
+    labelTables.textForKeyCode(keyCode, layout_index, text);
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WAYLANDKEYBOARD_H
+#define WAYLANDKEYBOARD_H
+
+#include "vkeyboard.h"
+#include "keylabels.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+
+#include <cstdint>
+
+class QSocketNotifier;
+
+struct wl_display;
+struct wl_registry;
+struct wl_seat;
+struct zwp_virtual_keyboard_manager_v1;
+struct zwp_virtual_keyboard_v1;
+
+struct xkb_context;
+struct xkb_keymap;
+struct xkb_state;
+
+// Native Wayland backend. Key events go straight to the compositor through
+// the zwp_virtual_keyboard_v1 protocol with a keymap compiled and uploaded
+// by kvkbd itself, so no XWayland round trip is involved.
+class WaylandKeyboard : public VKeyboard
+{
+    Q_OBJECT
+
+public:
+    WaylandKeyboard(QObject *parent = nullptr);
+    ~WaylandKeyboard();
+
+    //connected to a compositor offering the virtual keyboard protocol
+    bool isValid() const;
+
+    void textForKeyCode(unsigned int keyCode, ButtonText& text) override;
+
+public Q_SLOTS:
+    void processKeyPress(unsigned int) override;
+    void processKeyDown(unsigned int) override;
+    void processKeyUp(unsigned int) override;
+    void queryModState() override;
+    void start() override;
+
+protected Q_SLOTS:
+    void dispatchEvents();
+    void flush();
+
+protected:
+    void layoutListReady() override;
+    void currentLayoutReady() override;
+
+    static void registryGlobal(void *data, wl_registry *registry, uint32_t name, const char *interface, uint32_t version);
+    static void registryGlobalRemove(void *data, wl_registry *registry, uint32_t name);
+
+    bool compileKeymap();
+    bool uploadKeymap();
+    void sendKeyEvent(unsigned int keyCode, bool pressed);
+    void sendModifiers();
+    void updateLockState();
+
+    wl_display *display;
+    wl_registry *registry;
+    wl_seat *seat;
+    zwp_virtual_keyboard_manager_v1 *manager;
+    zwp_virtual_keyboard_v1 *keyboard;
+    QSocketNotifier *notifier;
+
+    xkb_context *context;
+    xkb_keymap *keymap;
+    xkb_state *state;
+
+    KeyLabelTables labelTables;
+    GroupState groupState;
+    //keys currently held down, with the modifiers pressed along with them
+    QHash<unsigned int, QList<unsigned int> > heldKeys;
+    QElapsedTimer clock;
+};
+
+#endif // WAYLANDKEYBOARD_H
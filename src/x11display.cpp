@@ -0,0 +1,111 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "x11display.h"
+
+#include <QAbstractEventDispatcher>
+#include <QDebug>
+#include <QSocketNotifier>
+
+#include <X11/Xlib.h>
+
+X11Display *X11Display::self = nullptr;
+int X11Display::connections = 0;
+bool X11Display::sealed = false;
+
+X11Display::X11Display(QObject *parent) : QObject(parent), notifier(nullptr)
+{
+    dpy = openConnection();
+    if (!dpy) {
+        qWarning() << "Unable to open X display";
+        return;
+    }
+
+    self = this;
+
+    notifier = new QSocketNotifier(ConnectionNumber(dpy), QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(processEvents()));
+
+    //Xlib may already have queued events while waiting for a reply,
+    //so drain the queue every time the event loop is about to sleep
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+    if (dispatcher) {
+        connect(dispatcher, SIGNAL(aboutToBlock()), this, SLOT(processEvents()));
+    }
+}
+
+X11Display::~X11Display()
+{
+    if (self == this) {
+        self = nullptr;
+    }
+    if (dpy) {
+        closeConnection(dpy);
+    }
+}
+
+X11Display *X11Display::instance()
+{
+    return self;
+}
+
+Display *X11Display::display()
+{
+    return self ? self->dpy : nullptr;
+}
+
+Display *X11Display::openConnection()
+{
+    if (sealed) {
+        qWarning() << "X connection opened after startup, total connections:" << connections + 1;
+    }
+
+    Display *display = XOpenDisplay(nullptr);
+    if (display) {
+        connections++;
+    }
+    return display;
+}
+
+void X11Display::closeConnection(Display *display)
+{
+    XCloseDisplay(display);
+}
+
+int X11Display::connectionCount()
+{
+    return connections;
+}
+
+void X11Display::seal()
+{
+    sealed = true;
+    qDebug() << "X connections opened during startup:" << connections;
+}
+
+void X11Display::processEvents()
+{
+    if (!dpy) return;
+
+    while (XPending(dpy)) {
+        XEvent event;
+        XNextEvent(dpy, &event);
+        Q_EMIT x11Event(&event);
+    }
+}
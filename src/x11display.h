@@ -0,0 +1,70 @@
+/*
+ * This file is part of the Kvkbd project.
+ * Copyright (C) 2020–2023 Anthony Fieroni, Fredrick R. Brennan and Kvkbd Developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef X11DISPLAY_H
+#define X11DISPLAY_H
+
+#include <QObject>
+
+class QSocketNotifier;
+
+typedef struct _XDisplay Display;
+typedef union _XEvent XEvent;
+
+// Long-lived X connection shared by the whole X11 backend. The instance is
+// owned by the backend; everything else reaches it through display().
+class X11Display : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit X11Display(QObject *parent = nullptr);
+    ~X11Display();
+
+    static X11Display *instance();
+
+    //shared connection, nullptr when no X11 backend is running
+    static Display *display();
+
+    //every XOpenDisplay of the application goes through here
+    static Display *openConnection();
+    static void closeConnection(Display *dpy);
+
+    //number of connections opened so far
+    static int connectionCount();
+
+    //mark the end of startup, any connection opened later is reported
+    static void seal();
+
+public Q_SLOTS:
+    void processEvents();
+
+Q_SIGNALS:
+    void x11Event(XEvent *event);
+
+protected:
+    Display *dpy;
+    QSocketNotifier *notifier;
+
+    static X11Display *self;
+    static int connections;
+    static bool sealed;
+};
+
+#endif // X11DISPLAY_H
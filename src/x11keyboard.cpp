@@ -19,13 +19,13 @@
  */
 
 #include "x11keyboard.h"
+#include "x11display.h"
+#include "latencystats.h"
 
-#include <QDBusConnection>
-#include <QDataStream>
-#include <QDBusInterface>
-#include <QDBusReply>
+#include <QDebug>
+#include <QTimer>
+#include <QtConcurrent>
 
-#include <X11/extensions/XTest.h>
 #include <X11/Xlocale.h>
 #include <X11/Xos.h>
 #include <X11/Xlib.h>
@@ -34,192 +34,463 @@
 
 #include <X11/XKBlib.h>
 
-#include "vbutton.h"
-extern QList<VButton *> modKeys;
-
-X11Keyboard::X11Keyboard(QObject *parent): VKeyboard(parent)
+X11Keyboard::X11Keyboard(QObject *parent): VKeyboard(parent), xkbEventBase(-1), capsLockMask(0), numLockMask(0),
+    keymapPending(false), latchModifiers(false), appliedModifiers(0), appliedLock(false)
 {
-    QString service = QLatin1String("");
-    QString path = QLatin1String("/Layouts");
-    QString interface = QLatin1String("org.kde.KeyboardLayouts");
+    xdisplay = new X11Display(this);
+
+
+    Display *display = X11Display::display();
+    if (display) {
+        int opcode, error;
+        int major = XkbMajorVersion;
+        int minor = XkbMinorVersion;
+
+        if (XkbQueryExtension(display, &opcode, &xkbEventBase, &error, &major, &minor)) {
+            capsLockMask = XkbKeysymToModifiers(display, XK_Caps_Lock);
+            numLockMask = XkbKeysymToModifiers(display, XK_Num_Lock);
 
-    QDBusConnection session = QDBusConnection::sessionBus();
+            //only wake up when the server reports a change of the locked modifiers
+            XkbSelectEventDetails(display, XkbUseCoreKbd, XkbStateNotify, XkbModifierLockMask, XkbModifierLockMask);
 
-    session.connect(service, path, interface, QLatin1String("currentLayoutChanged"), this, SLOT(layoutChanged()));
-    session.connect(service, path, interface, QLatin1String("layoutListChanged"), this, SLOT(constructLayouts()));
+            //keymap snapshot invalidation
+            unsigned int mapMask = XkbNewKeyboardNotifyMask | XkbMapNotifyMask;
+            XkbSelectEvents(display, XkbUseCoreKbd, mapMask, mapMask);
+        }
+        else {
+            qWarning() << "XKB extension not available, lock state will not be tracked";
+            xkbEventBase = -1;
+        }
+    }
 
-    constructLayouts();
-    groupTimer = new QTimer(parent);
-    groupTimer->setInterval(250);
+    connect(xdisplay, SIGNAL(x11Event(XEvent*)), this, SLOT(handleX11Event(XEvent*)));
 
-    groupState.insert(QLatin1String("capslock"), this->queryModKeyState(XK_Caps_Lock));
-    groupState.insert(QLatin1String("numlock"), this->queryModKeyState(XK_Num_Lock));
+    //completion is queued back to the GUI thread in submission order
+    injector = new KeyInjector(this);
+    connect(injector, SIGNAL(keySent(unsigned int)), this, SIGNAL(keyProcessComplete(unsigned int)));
+    injector->start();
 
-    connect(groupTimer, SIGNAL(timeout()), this, SLOT(queryModState()));
+    labelWatcher = new QFutureWatcher<KeyLabelTables>(this);
+    connect(labelWatcher, SIGNAL(finished()), this, SLOT(labelTablesReady()));
+
+    queryModState();
+    refreshKeymap();
 }
 
 X11Keyboard::~X11Keyboard()
 {
+    injector->stop();
+    injector->wait();
+
+    //do not leave modifiers latched or locked behind
+    Display *display = X11Display::display();
+    if (display && appliedModifiers) {
+        XkbLockModifiers(display, XkbUseCoreKbd, managedModifiers(), 0);
+        XkbLatchModifiers(display, XkbUseCoreKbd, managedModifiers(), 0);
+        XFlush(display);
+    }
 }
 
 void X11Keyboard::start()
 {
     layoutChanged();
+    groupState.changed = GroupState::AllGroups;
     Q_EMIT groupStateChanged(groupState);
-    groupTimer->start();
+
+    X11Display::seal();
+}
+
+void X11Keyboard::processKeyPress(unsigned int keyCode)
+{
+    submitKey(keyCode, KeyRequest::Click);
 }
 
-void X11Keyboard::constructLayouts()
+void X11Keyboard::processKeyDown(unsigned int keyCode)
 {
-    QDBusInterface iface(QLatin1String("org.kde.keyboard"), QLatin1String("/Layouts"), QLatin1String("org.kde.KeyboardLayouts"), QDBusConnection::sessionBus());
+    if (heldKeys.contains(keyCode)) return;
+    submitKey(keyCode, KeyRequest::Press);
+}
 
-    QDBusReply<QStringList> reply = iface.call(QLatin1String("getLayoutsList"));
-    if (reply.isValid()) {
+void X11Keyboard::processKeyUp(unsigned int keyCode)
+{
+    //the press was refused, nothing is down
+    if (!heldKeys.contains(keyCode)) return;
+    submitKey(keyCode, KeyRequest::Release);
+}
 
-        QStringList lst = reply.value();
-        layouts.clear();
+void X11Keyboard::submitKey(unsigned int keyCode, KeyRequest::Type type)
+{
+    LatencyTimer timer(LatencyStats::Process);
 
-        QListIterator<QString> itr(lst);
+    KeyRequest request;
 
-        while (itr.hasNext()) {
-            QString layout_name = itr.next();
-            layouts << layout_name;
+    if (type == KeyRequest::Release) {
+        //release the same modifiers that were pressed with the key
+        request = heldKeys.take(keyCode);
+    }
+    else {
+        request.keyCode = keyCode;
+        request.keySym = 0;
+        request.modifierCount = 0;
+
+        QListIterator<unsigned int> itr(checkedModifiers());
+        while (itr.hasNext() && request.modifierCount < KeyRequest::MaxModifiers) {
+            unsigned int modifier = itr.next();
+            //already applied as XKB state, unless the modmap does not know it
+            if (latchModifiers && modifierMasks.value(modifier)) continue;
+            request.modifiers[request.modifierCount++] = modifier;
         }
     }
-}
+    request.type = type;
+    request.timestamp = LatencyStats::tapTimestamp();
+
+    //every held key keeps a slot for its release, a press also for its own
+    int reserved = heldKeys.count();
+    if (type == KeyRequest::Release) reserved = 0;
+    else if (type == KeyRequest::Press) reserved++;
+
+    //keyProcessComplete only ever comes from the injector, in order, so a
+    //refused key leaves the modifiers checked for the next one
+    if (!injector->submit(request, reserved)) {
+        qWarning() << "Key injection queue is full, dropping key" << keyCode;
+        return;
+    }
 
-void X11Keyboard::processKeyPress(unsigned int keyCode)
-{
-    groupTimer->stop();
-    sendKey(keyCode);
-    Q_EMIT keyProcessComplete(keyCode);
-    groupTimer->start();
+    if (type == KeyRequest::Press) {
+        heldKeys.insert(keyCode, request);
+    }
 }
 
-void X11Keyboard::sendKey(unsigned int keycode)
+bool X11Keyboard::typeText(const QString& text)
 {
-    Window currentFocus;
-    int revertTo;
+    LatencyTimer timer(LatencyStats::Process);
+
+    Display *display = X11Display::display();
+    if (!display) return false;
 
-    Display *display = XOpenDisplay(nullptr);
-    XGetInputFocus(display, &currentFocus, &revertTo);
+    unsigned int shiftKeyCode = XKeysymToKeycode(display, XK_Shift_L);
+    unsigned int levelThreeKeyCode = XKeysymToKeycode(display, XK_ISO_Level3_Shift);
 
-    QListIterator<VButton *> itr(modKeys);
+    const KeySymIndex& index = labelTables.keySymIndex();
+    KeySymConvert kconvert;
+
+    //keysyms the keymap lacks are bound to spare key codes by the injector
+    QHash<uint, KeyRequest> resolved;
+    bool complete = true;
+
+    KeySequence sequence;
+    QVector<uint> characters = text.toUcs4();
+    sequence.keys.reserve(characters.count());
+
+    bool capsLock = groupState.isSet(GroupState::CapsLock);
+
+    QVectorIterator<uint> itr(characters);
     while (itr.hasNext()) {
-        VButton *mod = itr.next();
-        if (mod->isChecked()) {
-            XTestFakeKeyEvent(display, mod->getKeyCode(), true, 2);
+        uint ucs = itr.next();
+
+        if (!resolved.contains(ucs)) {
+            KeyRequest request;
+            request.type = KeyRequest::Click;
+            request.keyCode = 0;
+            request.keySym = 0;
+            request.modifierCount = 0;
+
+            KeySym keysym = NoSymbol;
+            if (ucs == '\n') keysym = XK_Return;
+            else if (ucs == '\t') keysym = XK_Tab;
+            else if (ucs == '\b') keysym = XK_BackSpace;
+            else keysym = kconvert.keySym(ucs);
+
+            KeyPosition position;
+            if (keysym != NoSymbol && index.find(keysym, layout_index, position)) {
+                int level = position.level;
+
+                //caps lock swaps the first two levels of cased letters
+                QChar::Category category = QChar::category(ucs);
+                if (capsLock && level < 2 && (category == QChar::Letter_Lowercase || category == QChar::Letter_Uppercase)) {
+                    level ^= 1;
+                }
+
+                request.keyCode = position.keyCode;
+                if ((level & 1) && shiftKeyCode) {
+                    request.modifiers[request.modifierCount++] = shiftKeyCode;
+                }
+                if ((level & 2) && levelThreeKeyCode) {
+                    request.modifiers[request.modifierCount++] = levelThreeKeyCode;
+                }
+                //a level whose modifier is missing is unreachable
+                if (((level & 1) && !shiftKeyCode) || ((level & 2) && !levelThreeKeyCode)) {
+                    request.keyCode = 0;
+                    request.modifierCount = 0;
+                }
+            }
+
+            if (!request.keyCode) {
+                request.keySym = keysym;
+            }
+            resolved.insert(ucs, request);
         }
+
+        const KeyRequest& request = resolved[ucs];
+        if (!request.keyCode && !request.keySym) {
+            complete = false;
+            continue;
+        }
+        sequence.keys << request;
     }
 
-    XTestFakeKeyEvent(display, keycode, true, 2);
-    XTestFakeKeyEvent(display, keycode, false, 2);
+    if (sequence.keys.isEmpty()) return complete;
 
-    itr.toFront();
-    while (itr.hasNext()) {
-        VButton *mod = itr.next();
-        if (mod->isChecked()) {
-            XTestFakeKeyEvent(display, mod->getKeyCode(), false, 2);
-        }
+    if (!injector->submitSequence(sequence, heldKeys.count())) {
+        qWarning() << "Key injection queue is full, dropping text";
+        return false;
     }
-    XFlush(display);
-    XCloseDisplay(display);
+    return complete;
 }
 
-bool X11Keyboard::queryModKeyState(KeySym iKey)
+void X11Keyboard::pressKeys(const KeyStrokeList& keys)
 {
-    int          iKeyMask = 0;
-    Window       wDummy1, wDummy2;
-    int          iDummy3, iDummy4, iDummy5, iDummy6;
-    unsigned int iMask;
+    LatencyTimer timer(LatencyStats::Process);
+
+    //first key code carrying each modifier bit
+    unsigned int modifierKeyCodes[8] = { 0 };
+    QHashIterator<unsigned int, unsigned int> mitr(modifierMasks);
+    while (mitr.hasNext()) {
+        mitr.next();
+        for (int bit=0; bit<8; bit++) {
+            if ((mitr.value() & (1 << bit)) && (!modifierKeyCodes[bit] || mitr.key() < modifierKeyCodes[bit])) {
+                modifierKeyCodes[bit] = mitr.key();
+            }
+        }
+    }
 
-    Display* display = XOpenDisplay(nullptr);
+    KeySequence sequence;
+    sequence.keys.reserve(keys.count());
 
-    XModifierKeymap* map = XGetModifierMapping(display);
-    KeyCode keyCode = XKeysymToKeycode(display, iKey);
-    if (keyCode == NoSymbol) return false;
-    for (int i = 0; i < 8; ++i) {
-        if (map->modifiermap[map->max_keypermod * i] == keyCode) {
-            iKeyMask = 1 << i;
+    QListIterator<KeyStroke> itr(keys);
+    while (itr.hasNext()) {
+        const KeyStroke& stroke = itr.next();
+
+        KeyRequest request;
+        request.type = KeyRequest::Click;
+        request.keyCode = stroke.keyCode;
+        request.keySym = 0;
+        request.modifierCount = 0;
+
+        for (int bit=0; bit<8; bit++) {
+            if ((stroke.modifiers & (1 << bit)) && modifierKeyCodes[bit]) {
+                request.modifiers[request.modifierCount++] = modifierKeyCodes[bit];
+            }
         }
+        sequence.keys << request;
+    }
+
+    if (sequence.keys.isEmpty()) return;
+
+    if (!injector->submitSequence(sequence, heldKeys.count())) {
+        qWarning() << "Key injection queue is full, dropping key sequence";
     }
-    XQueryPointer(display, DefaultRootWindow(display), &wDummy1, &wDummy2, &iDummy3, &iDummy4, &iDummy5, &iDummy6, &iMask);
-    XFreeModifiermap(map);
-    XCloseDisplay(display);
-    return ((iMask & iKeyMask) != 0);
 }
 
-void X11Keyboard::queryModState()
+void X11Keyboard::setModifierLatching(bool mode)
 {
+    if (mode == latchModifiers) return;
 
-    bool curr_caps_state = this->queryModKeyState(XK_Caps_Lock);
-    bool curr_num_state = this->queryModKeyState(XK_Num_Lock);
+    if (!mode && appliedModifiers) {
+        submitModifiers(0, appliedLock);
+    }
+    latchModifiers = mode;
+}
 
-    bool caps_state = groupState.value(QLatin1String("capslock"));
-    bool num_state = groupState.value(QLatin1String("numlock"));
+void X11Keyboard::modifiersChanged(bool sticky)
+{
+    if (!latchModifiers) return;
 
-    groupState.insert(QLatin1String("capslock"), curr_caps_state);
-    groupState.insert(QLatin1String("numlock"), curr_num_state);
+    unsigned int mask = 0;
+    QListIterator<unsigned int> itr(checkedModifiers());
+    while (itr.hasNext()) {
+        mask |= modifierMasks.value(itr.next());
+    }
+    mask &= managedModifiers();
 
-    if (curr_caps_state != caps_state || curr_num_state != num_state) {
+    if (mask == appliedModifiers && sticky == appliedLock) return;
 
-        Q_EMIT groupStateChanged(groupState);
-    }
+    submitModifiers(mask, sticky);
 }
 
-void X11Keyboard::layoutChanged()
+void X11Keyboard::submitModifiers(unsigned int mask, bool lock)
 {
-    //std::cerr << "LayoutChanged" << std::endl;
+    KeyRequest request;
+    request.type = KeyRequest::Modifiers;
+    request.keyCode = 0;
+    request.keySym = 0;
+    request.timestamp = LatencyStats::tapTimestamp();
+    request.modifierCount = 0;
+    request.modifierMask = mask;
+    request.affectMask = managedModifiers();
+    request.lockModifiers = lock;
+
+    //queued with the keys, so the state is in place before the next one
+    if (!injector->submit(request, heldKeys.count())) {
+        qWarning() << "Key injection queue is full, dropping modifier state";
+        return;
+    }
+    appliedModifiers = mask;
+    appliedLock = lock;
+}
 
-    QDBusInterface iface(QLatin1String("org.kde.keyboard"), QLatin1String("/Layouts"), QLatin1String("org.kde.KeyboardLayouts"), QDBusConnection::sessionBus());
+unsigned int X11Keyboard::managedModifiers() const
+{
+    return 0xff & ~(LockMask | capsLockMask | numLockMask);
+}
 
-    QDBusReply<QString> reply = iface.call(QLatin1String("getCurrentLayout"));
+void X11Keyboard::queryModState()
+{
+    Display *display = X11Display::display();
+    if (!display || xkbEventBase < 0) return;
 
-    if (reply.isValid()) {
+    XkbStateRec state;
+    if (XkbGetState(display, XkbUseCoreKbd, &state) == Success) {
+        updateLockState(state.locked_mods);
+    }
+}
 
-        QString current_layout = reply.value();
+void X11Keyboard::handleX11Event(XEvent *event)
+{
+    if (event->type == MappingNotify) {
+        XRefreshKeyboardMapping(&event->xmapping);
+        if (event->xmapping.request == MappingKeyboard && !injectorOwns(event->xmapping.first_keycode, event->xmapping.count)) {
+            invalidateKeymap();
+        }
+        return;
+    }
 
-        layout_index = layouts.indexOf(current_layout);
+    if (xkbEventBase < 0 || event->type != xkbEventBase + XkbEventCode) return;
+
+    XkbEvent *xkbEvent = (XkbEvent *) event;
+    switch (xkbEvent->any.xkb_type) {
+    case XkbStateNotify:
+        updateLockState(xkbEvent->state.locked_mods);
+        break;
+    case XkbMapNotify: {
+        //the injector binding keysyms to its spare key codes
+        const XkbMapNotifyEvent& map = xkbEvent->map;
+        if (!(map.changed & XkbKeyTypesMask)
+            && injectorOwns(map.first_key_sym, map.num_key_syms)
+            && injectorOwns(map.first_key_act, map.num_key_acts)
+            && injectorOwns(map.first_key_behavior, map.num_key_behaviors)
+            && injectorOwns(map.first_key_explicit, map.num_key_explicit)
+            && injectorOwns(map.first_modmap_key, map.num_modmap_keys)
+            && injectorOwns(map.first_vmodmap_key, map.num_vmodmap_keys)) {
+            break;
+        }
+        invalidateKeymap();
+        break;
+    }
+    case XkbNewKeyboardNotify:
+        invalidateKeymap();
+        break;
+    }
+}
 
-        Q_EMIT layoutUpdated(layout_index, layouts.at(layout_index));
-    } else {
-        layout_index = 0;
-        Q_EMIT layoutUpdated(0, QLatin1String("us"));
+bool X11Keyboard::injectorOwns(int firstKeyCode, int count) const
+{
+    for (int keyCode=firstKeyCode; keyCode<firstKeyCode+count; keyCode++) {
+        if (!injector->ownsKeyCode(keyCode)) return false;
     }
+    return true;
 }
-void X11Keyboard::textForKeyCode(unsigned int keyCode,  ButtonText& text)
+
+void X11Keyboard::invalidateKeymap()
 {
-    if (keyCode==0) {
-        text.clear();
-        return;
+    //the new keymap may have put symbols on the injector's spare key codes
+    injector->keymapChanged();
+
+    if (keymapPending) return;
+
+    keymapPending = true;
+
+    //several notifications arrive for a single keymap change, rebuild once
+    QTimer::singleShot(0, this, SLOT(refreshKeymap()));
+}
+
+void X11Keyboard::refreshKeymap()
+{
+    keymapPending = false;
+
+    Display *display = X11Display::display();
+    if (!display) return;
+
+    //every group and level of the whole keymap in one request
+    XkbDescPtr xkb = XkbGetMap(display, XkbKeySymsMask | XkbModifierMapMask, XkbUseCoreKbd);
+    if (!xkb) return;
+
+    modifierMasks.clear();
+    for (int keyCode=xkb->min_key_code; keyCode<=xkb->max_key_code; keyCode++) {
+        if (xkb->map->modmap[keyCode]) {
+            modifierMasks.insert(keyCode, xkb->map->modmap[keyCode]);
+        }
     }
 
-    KeyCode button_code = keyCode;
+    KeymapSnapshot snapshot;
+    snapshot.reset(xkb->min_key_code, xkb->max_key_code, 1);
 
-    int keysyms_per_keycode = 0;
+    for (int keyCode=xkb->min_key_code; keyCode<=xkb->max_key_code; keyCode++) {
 
-    Display *display = XOpenDisplay(nullptr);
-    KeySym *keysym = XGetKeyboardMapping(display, button_code, 1, &keysyms_per_keycode);
+        //temporary bindings would make typeText pick a key code that
+        //may be unbound again by the time it is sent
+        if (injector->ownsKeyCode(keyCode)) continue;
 
-    int index_normal = layout_index * 2;
-    int index_shift = index_normal + 1;
+        int groupCount = qMin((int) XkbKeyNumGroups(xkb, keyCode), (int) KeymapSnapshot::MaxGroups);
+        snapshot.groupCount = qMax(snapshot.groupCount, groupCount);
 
-    KeySym normal = keysym[index_normal];
-    KeySym shift = keysym[index_shift];
+        for (int group=0; group<groupCount; group++) {
+            int width = qMin((int) XkbKeyGroupWidth(xkb, keyCode, group), (int) KeymapSnapshot::LevelCount);
+            for (int level=0; level<width; level++) {
+                snapshot.keySym(keyCode, group, level) = XkbKeySymEntry(xkb, keyCode, level, group);
+            }
+        }
 
+        //keys with fewer groups repeat their first one, like the server does
+        for (int group=groupCount; group<KeymapSnapshot::MaxGroups && groupCount>0; group++) {
+            for (int level=0; level<KeymapSnapshot::LevelCount; level++) {
+                snapshot.keySym(keyCode, group, level) = snapshot.keySym(keyCode, group % groupCount, level);
+            }
+        }
+    }
+
+    XkbFreeClientMap(xkb, 0, True);
 
-    long int ret = kconvert.convert(normal);
-    long int shiftRet = kconvert.convert(shift);
+    labelWatcher->setFuture(QtConcurrent::run(KeyLabelTables::build, snapshot));
+}
 
-    QChar normalText = QChar((uint)ret);
-    QChar shiftText = QChar((uint)shiftRet);
+void X11Keyboard::labelTablesReady()
+{
+    labelTables = labelWatcher->result();
 
-    //cout <<  "Normal Text " << normalText.toAscii() << " Shift Text: " << shiftText.toAscii() << std::endl;
+    Q_EMIT layoutUpdated(layout_index, layouts.value(layout_index, QLatin1String("us")));
+}
 
-    text.clear();
-    text.append(normalText);
-    text.append(shiftText);
+void X11Keyboard::updateLockState(unsigned int lockedMods)
+{
+    bool curr_caps_state = (lockedMods & capsLockMask) != 0;
+    bool curr_num_state = (lockedMods & numLockMask) != 0;
+
+    groupState.changed = 0;
+    groupState.set(GroupState::CapsLock, curr_caps_state);
+    groupState.set(GroupState::NumLock, curr_num_state);
+
+    if (groupState.changed) {
+        Q_EMIT groupStateChanged(groupState);
+    }
+}
+
+void X11Keyboard::textForKeyCode(unsigned int keyCode,  ButtonText& text)
+{
+    if (keyCode==0) {
+        text.clear();
+        return;
+    }
 
-    XFree((char *) keysym);
-    XCloseDisplay(display);
+    labelTables.textForKeyCode(keyCode, layout_index, text);
 }
@@ -27,10 +27,14 @@
 #include "vkeyboard.h"
 
 #include <QObject>
-#include <QTimer>
-#include <QStringList>
 #include <QChar>
 #include <QMap>
+#include <QHash>
+#include <QFutureWatcher>
+
+#include "x11display.h"
+#include "keyinjector.h"
+#include "keylabels.h"
 
 class X11Keyboard : public VKeyboard
 {
@@ -41,24 +45,56 @@ public:
     ~X11Keyboard();
     void textForKeyCode(unsigned int keyCode, ButtonText& text) override;
 
+    bool typeText(const QString& text) override;
+    void pressKeys(const KeyStrokeList& keys) override;
+
 public Q_SLOTS:
     void processKeyPress(unsigned int) override;
+    void processKeyDown(unsigned int) override;
+    void processKeyUp(unsigned int) override;
     void queryModState() override;
-    void constructLayouts() override;
-    void layoutChanged() override;
+    void setModifierLatching(bool mode) override;
+    void modifiersChanged(bool sticky) override;
     void start() override;
 
+protected Q_SLOTS:
+    void handleX11Event(XEvent *event);
+    void refreshKeymap();
+    void labelTablesReady();
+
 protected:
-    void sendKey(unsigned int keycode);
+    void updateLockState(unsigned int lockedMods);
+    GroupState groupState;
+
+    int xkbEventBase;
+    unsigned int capsLockMask;
+    unsigned int numLockMask;
+
+    //label tables are rebuilt off the GUI thread on keymap changes
+    void invalidateKeymap();
+    //true when the key code range only holds injector bindings, or is empty
+    bool injectorOwns(int firstKeyCode, int count) const;
+
+    KeyLabelTables labelTables;
+    QFutureWatcher<KeyLabelTables> *labelWatcher;
+    bool keymapPending;
 
-    QStringList layouts;
-    int layout_index;
+    void submitKey(unsigned int keyCode, KeyRequest::Type type);
+    void submitModifiers(unsigned int mask, bool lock);
+    //every real modifier except the caps and num locks
+    unsigned int managedModifiers() const;
 
-    KeySymConvert kconvert;
+    X11Display *xdisplay;
+    KeyInjector *injector;
+    //keys currently held down, with the modifiers pressed along with them
+    QHash<unsigned int, KeyRequest> heldKeys;
 
-    bool queryModKeyState(KeySym keyCode);
-    ModifierGroupStateMap groupState;
-    QTimer *groupTimer;
+    //modifier mask of each modifier key code, from the XKB modmap
+    QHash<unsigned int, unsigned int> modifierMasks;
+    bool latchModifiers;
+    //last state handed to the injector
+    unsigned int appliedModifiers;
+    bool appliedLock;
 };
 
 #endif // X11KEYBOARD_H